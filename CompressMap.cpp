@@ -1,12 +1,18 @@
 #include "CompressMap.h"
-#include "common.h"
+#include <cstring>
+#include <cassert>
 #include "zlib.h"
 
-const int kCompressBlockBufSize = 16*1024;
-
-CompressStorage::CompressStorage( int size /*= 0*/ )
+CompressStorage::CompressStorage( int size /*= 0*/, i_buf_allocator* alloc /*= NULL*/ )
 {
+	buf_alloc = alloc;
 	default_bufsize = size > 0 ? size : kCompressBlockBufSize;
+	next_key = 1;
+	cached_idx = -1;
+	write_idx = -1;
+#ifdef COMPRESSMAP_STATS
+	memset(&stats, 0, sizeof(stats));
+#endif
 }
 
 CompressStorage::~CompressStorage()
@@ -31,7 +37,7 @@ void CompressStorage::_BlockClear( _Block* block )
 void CompressStorage::_BlockClearBuf( _Block* block )
 {
 	if (block->buf)
-		delete [] block->buf;
+		_Free(block->buf, block->buf_len);
 	block->buf = NULL;
 	block->buf_len = 0;
 	block->w_off = 0;
@@ -40,39 +46,101 @@ void CompressStorage::_BlockClearBuf( _Block* block )
 void CompressStorage::_BlockClearCBuf( _Block* block )
 {
 	if (block->cbuf)
-		delete [] block->cbuf;
+		_Free(block->cbuf, block->cbuf_len);
 	block->cbuf = NULL;
 	block->cbuf_len = 0;
 }
 
-void CompressStorage::_BlockNew( _Block* block, int size )
+CompressStorage::_Block* CompressStorage::_BlockPushBack()
 {
+	blocks.resize(blocks.size() + 1);
+	_Block* block = &blocks.back();
+	_BlockNew(block);
+	block->idx = (int64_t)blocks.size() - 1;
+	return block;
+}
+
+CompressStorage::_Block* CompressStorage::_BlockAcquire()
+{
+	// reuse a recycled slot before growing blocks
+	if (free_blocks.empty())
+		return _BlockPushBack();
+
+	int64_t idx = free_blocks.back();
+	free_blocks.pop_back();
+	_Block* block = &blocks[idx];
+	_BlockNew(block);
+	block->idx = idx;
+	return block;
+}
+
+void CompressStorage::_BlockFree( int64_t idx )
+{
+	_Block* block = &blocks[idx];
+#ifdef COMPRESSMAP_STATS
+	stats.dead_bytes -= _BlockDataLen(block);
+#endif
+	_BlockClear(block);
+	block->idx = idx;
+	block->next = -1;
+	free_blocks.push_back(idx);
+	if (cached_idx == idx)
+		cached_idx = -1;
+	if (write_idx == idx)
+		write_idx = -1;
+}
+
+void CompressStorage::_BlockNew( _Block* block )
+{
+	// always default_bufsize, larger values are split by Insert
 	memset(block, 0, sizeof(_Block));
-	_BlockNewBuf(block, default_bufsize > size ? default_bufsize : size);
+	block->next = -1;
+	_BlockNewBuf(block, default_bufsize);
 }
 
-void CompressStorage::_BlockNewBuf( _Block* block, int size )
+void CompressStorage::_BlockNewBuf( _Block* block, int64_t size )
 {
 	if (size > block->buf_len)
 	{
 		_BlockClearBuf(block);
 		block->buf_len = size;
-		block->buf = new char [block->buf_len];
+		block->buf = _Alloc(block->buf_len);
 	}
 	block->w_off = 0;
 }
 
-void CompressStorage::_BlockNewCBuf( _Block* block, int size )
+void CompressStorage::_BlockNewCBuf( _Block* block, int64_t size )
 {
 	if (size > block->cbuf_len)
 	{
 		_BlockClearCBuf(block);
 		block->cbuf_len = size;
-		block->cbuf = new char [block->cbuf_len];
+		block->cbuf = _Alloc(block->cbuf_len);
 	}
 }
 
-bool CompressStorage::_BlockIsSufficient( _Block* block, int len )
+char* CompressStorage::_Alloc( int64_t size )
+{
+	if (buf_alloc)
+		return buf_alloc->allocate((size_t)size);
+	return new char [(size_t)size];
+}
+
+void CompressStorage::_Free( char* p, int64_t size )
+{
+	if (buf_alloc)
+		buf_alloc->deallocate(p, (size_t)size);
+	else
+		delete [] p;
+}
+
+int64_t CompressStorage::_BlockDataLen( _Block* block )
+{
+	// w_off is reset when a compressed block is inflated again
+	return block->cbuf ? block->old_len : block->w_off;
+}
+
+bool CompressStorage::_BlockIsSufficient( _Block* block, int64_t len )
 {
 	if (block->cbuf)
 		return false;
@@ -81,7 +149,7 @@ bool CompressStorage::_BlockIsSufficient( _Block* block, int len )
 	return true;
 }
 
-bool CompressStorage::_BlockWrite( _Block* block, Pointer* ptr, char* src, int src_len, int w_off /*= -1*/ )
+bool CompressStorage::_BlockWrite( _Block* block, Pointer* ptr, const char* src, int64_t src_len, int64_t w_off /*= -1*/ )
 {
 	if (w_off == -1)
 		w_off = block->w_off;
@@ -91,22 +159,31 @@ bool CompressStorage::_BlockWrite( _Block* block, Pointer* ptr, char* src, int s
 	if (w_off == -1)
 		block->w_off += src_len;
 	else
-		block->w_off = max(block->w_off, w_off + src_len);
+		block->w_off = std::max(block->w_off, w_off + src_len);
 	return true;
 }
 
 bool CompressStorage::_BlockCompress( _Block* block )
 {
-	block->compress_len = compressBound(block->buf_len);
+	// already compressed, buf is only a decompressed copy
+	if (block->cbuf || block->w_off == 0)
+		return true;
+
+	block->compress_len = compressBound((uLong)block->w_off);
 	std::string buf;
 	buf.resize(block->compress_len);
 	
-	int ret = compress((Bytef *)buf.c_str(), (uLongf *)&block->compress_len, (const Bytef *)block->buf, block->w_off);
+	uLongf compress_len = (uLongf)block->compress_len; // uLongf is 64 bits on LP64
+	int ret = compress((Bytef *)buf.c_str(), &compress_len, (const Bytef *)block->buf, (uLong)block->w_off);
 	if (ret != Z_OK)
 	{
 		assert(false);
 		return false;
 	}
+	block->compress_len = (int64_t)compress_len;
+#ifdef COMPRESSMAP_STATS
+	++ stats.compress_count;
+#endif
 	
 	_BlockNewCBuf(block, block->compress_len);
 	memcpy(block->cbuf, (char*)buf.c_str(), block->compress_len);
@@ -122,19 +199,27 @@ bool CompressStorage::_BlockUnCompress( _Block* block )
 	if (block->buf != NULL)
 		return true;
 	
+#ifdef COMPRESSMAP_STATS
+	uint64_t start = compress_stats_now();
+#endif
 	_BlockNewBuf(block, block->old_len);
-	int uncompress_len = block->old_len;
-	int ret = uncompress((Bytef *)block->buf, (uLongf *)&uncompress_len, (const Bytef *)block->cbuf, block->compress_len);
-	if (ret != Z_OK || uncompress_len != block->old_len)
+	uLongf uncompress_len = (uLongf)block->old_len;
+	int ret = uncompress((Bytef *)block->buf, &uncompress_len, (const Bytef *)block->cbuf, (uLong)block->compress_len);
+	if (ret != Z_OK || uncompress_len != (uLongf)block->old_len)
 	{
 		assert(false);
 		return false;
 	}
+#ifdef COMPRESSMAP_STATS
+	++ stats.decompress_count;
+	stats.inflated_bytes += block->old_len;
+	compress_stats_time(start, stats.decompress_us, stats.decompress_hist);
+#endif
 
 	return true;
 }
 
-bool CompressStorage::_BlockCopy( _Block* block, char* dst, int off, int len )
+bool CompressStorage::_BlockCopy( _Block* block, char* dst, int64_t off, int64_t len )
 {
 	if (off + len > block->cbuf_len)
 		return false;
@@ -145,7 +230,7 @@ bool CompressStorage::_BlockCopy( _Block* block, char* dst, int off, int len )
 
 bool CompressStorage::_BlockMove( _Block* block, _Block* block_src, Pointer* ptr )
 {
-	int len = ptr->len;
+	int64_t len = ptr->len;
 	if (block->w_off + len > block->cbuf_len)
 		return false;
 
@@ -156,87 +241,186 @@ bool CompressStorage::_BlockMove( _Block* block, _Block* block_src, Pointer* ptr
 	return true;
 }
 
-int CompressStorage::Insert( char* src, int src_len )
+void CompressStorage::_WriteSmall( const char* src, int64_t src_len, Pointer* ptr )
 {
 	// find block
 	_Block* block = NULL;
-	if (!blocks.empty())
-	{
-		if (_BlockIsSufficient(&blocks.back(), src_len))
-			block = &blocks.back();
-	}
+	if (write_idx != -1 && _BlockIsSufficient(&blocks[write_idx], src_len))
+		block = &blocks[write_idx];
 
 	// new block
 	if (block == NULL)
 	{
-		blocks.resize(blocks.size() + 1);
-		block = &blocks.back();
-		_BlockNew(block, src_len);
-		block->idx = (int)blocks.size() - 1;
+		block = _BlockAcquire();
+		write_idx = block->idx;
 	}
 
 	// write
 	// lazy compress
+	ptr->idx = block->idx;
+	_BlockWrite(block, ptr, src, src_len);
+	block->live_len += src_len;
+}
+
+int64_t CompressStorage::Insert( const char* src, int64_t src_len )
+{
 	Pointer ret;
-	ret.idx = block->idx;
-	_BlockWrite(block, &ret, src, src_len);
+	if (src_len > default_bufsize)
+	{
+		// larger than a block, split into full blocks chained by next, Read inflates one at a time
+		_Block* block = _BlockAcquire();
+		ret.idx = block->idx;
+		ret.off = 0;
+		for (int64_t done = 0; done < src_len; done += block->w_off)
+		{
+			if (done > 0)
+			{
+				int64_t prev = block->idx;
+				block = _BlockAcquire();
+				blocks[prev].next = block->idx;
+			}
+			Pointer chunk;
+			_BlockWrite(block, &chunk, src + done, std::min<int64_t>(src_len - done, block->buf_len));
+			block->live_len = block->w_off;
+		}
+		ret.len = src_len;
+	}
+	else
+		_WriteSmall(src, src_len, &ret);
 
 	// write index
-	if (keymap.empty())
-		ret.key = 1;
-	else
-		ret.key = keymap.rbegin()->first + 1;
+	ret.key = next_key ++;
 	keymap[ret.key] = ret;
 
 	return ret.key;
 }
 
-void CompressStorage::Remove( int key )
+void CompressStorage::Remove( int64_t key )
 {
-	//TODO: recycle buf, cbuf
 	_PointMap::iterator it = keymap.find(key);
 	if (it == keymap.end())
 		return;
 
+	Pointer pos = it->second;
+#ifdef COMPRESSMAP_STATS
+	stats.dead_bytes += pos.len;
+#endif
 	keymap.erase(it);
+
+	// release every block the value leaves empty
+	int64_t left = pos.len;
+	int64_t block_off = pos.off;
+	for (int64_t idx = pos.idx; left > 0 && idx >= 0; block_off = 0)
+	{
+		_Block* block = &blocks[idx];
+		int64_t n = std::min(left, _BlockDataLen(block) - block_off);
+		int64_t next = block->next;
+		block->live_len -= n;
+		left -= n;
+		if (block->live_len == 0)
+		{
+			if (idx == write_idx && block->cbuf == NULL)
+			{	// still open, rewind instead of freeing
+#ifdef COMPRESSMAP_STATS
+				stats.dead_bytes -= block->w_off;
+#endif
+				block->w_off = 0;
+			}
+			else
+				_BlockFree(idx);
+		}
+		idx = next;
+	}
 }
 
-CompressStorage::Pointer CompressStorage::Query( int key )
+CompressStorage::Pointer CompressStorage::Query( int64_t key )
 {
 	_PointMap::iterator it = keymap.find(key);
 	if (it == keymap.end())
 	{
-		static Pointer null_ptr = {0};
+		static Pointer null_ptr = {};
 		return null_ptr;
 	}
 
 	return it->second;
 }
 
-char* CompressStorage::GetData( int key )
+char* CompressStorage::GetData( int64_t key )
 {
 	Pointer pos = Query(key);
-	if (pos.key != key)
+	if (pos.key != key || pos.len > default_bufsize)
 		return NULL;
 
-	static int pre_idx = -1;
-	if (pre_idx != -1 && pre_idx != pos.idx)
-		_BlockClearBuf(&blocks[pre_idx]);
-	pre_idx = pos.idx;
+	if (cached_idx != -1 && cached_idx != pos.idx && cached_idx < (int64_t)blocks.size() && blocks[cached_idx].cbuf)
+		_BlockClearBuf(&blocks[cached_idx]);
+	cached_idx = pos.idx;
 	return GetData(pos);
 }
 
 char* CompressStorage::GetData( Pointer pos )
 {
-	if (pos.key <= 0 || pos.idx < 0 || pos.idx >= (int)blocks.size())
+	if (pos.key <= 0 || pos.idx < 0 || pos.idx >= (int64_t)blocks.size() || pos.len > default_bufsize)
 		return NULL;
 
 	_Block* block = &blocks[pos.idx];
+#ifdef COMPRESSMAP_STATS
+	if (block->buf)
+		++ stats.reuse_hit;
+	else
+		++ stats.reuse_miss;
+	stats.read_bytes += pos.len;
+#endif
 	_BlockUnCompress(block);
 
 	return block->buf + pos.off;
 }
 
+int64_t CompressStorage::Read( int64_t key, int64_t off, char* dst, int64_t len )
+{
+	// copy [off, off + len) of the value, inflating only the blocks that range covers
+	Pointer pos = Query(key);
+	if (pos.key != key || off < 0 || off >= pos.len || len <= 0)
+		return 0;
+	len = std::min(len, pos.len - off);
+
+	int64_t done = 0;
+	int64_t block_off = pos.off; // value start inside the block
+	for (int64_t idx = pos.idx; done < len && idx >= 0; idx = blocks[idx].next, block_off = 0)
+	{
+		_Block* block = &blocks[idx];
+		int64_t avail = _BlockDataLen(block) - block_off;
+		if (off >= avail)
+		{
+			off -= avail; // chunk before the range, not inflated
+			continue;
+		}
+
+		bool inflated = block->buf != NULL;
+#ifdef COMPRESSMAP_STATS
+		if (inflated)
+			++ stats.reuse_hit;
+		else
+			++ stats.reuse_miss;
+#endif
+		_BlockUnCompress(block);
+		if (block->buf == NULL)
+			break;
+
+		int64_t n = std::min(avail - off, len - done);
+		memcpy(dst + done, block->buf + block_off + off, (size_t)n);
+		done += n;
+		off = 0;
+
+		// drop what we inflated, a huge value holds at most one block at a time
+		if (!inflated && block->cbuf)
+			_BlockClearBuf(block);
+	}
+#ifdef COMPRESSMAP_STATS
+	stats.read_bytes += done;
+#endif
+	return done;
+}
+
 struct pointer_cmp_by_off
 {
 	typedef CompressStorage::Pointer pointer;
@@ -251,13 +435,71 @@ struct pointer_cmp_by_off
 	}
 };
 
+void CompressStorage::_Compact()
+{
+	// move the live values out of sparse compressed blocks, then free those blocks
+	std::vector <char> sparse(blocks.size(), 0);
+	bool any = false;
+	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
+	{
+		if (it->cbuf && it->live_len > 0 && it->live_len * kCompressCompactRatio < _BlockDataLen(&(*it)))
+		{
+			sparse[it->idx] = 1;
+			any = true;
+		}
+	}
+	if (!any)
+		return;
+
+	std::vector <std::pair <int64_t, Pointer*> > moves; // grouped by block so each inflates once
+	for (_PointMap::iterator it = keymap.begin(); it != keymap.end(); ++ it)
+	{
+		Pointer& pos = it->second;
+		if (pos.len <= default_bufsize && sparse[pos.idx])
+			moves.push_back(std::make_pair(pos.idx, &pos));
+	}
+	std::sort(moves.begin(), moves.end());
+
+	std::string tmp;
+	for (size_t i = 0; i < moves.size(); )
+	{
+		int64_t idx = moves[i].first;
+		if (!_BlockUnCompress(&blocks[idx]))
+		{
+			for (; i < moves.size() && moves[i].first == idx; ++ i) {}
+			continue;
+		}
+		for (; i < moves.size() && moves[i].first == idx; ++ i)
+		{
+			Pointer* pos = moves[i].second;
+			tmp.assign(blocks[idx].buf + pos->off, (size_t)pos->len); // blocks may grow below
+#ifdef COMPRESSMAP_STATS
+			stats.dead_bytes += pos->len; // the old copy, dropped with its block
+#endif
+			_WriteSmall(tmp.data(), pos->len, pos);
+			blocks[idx].live_len -= pos->len;
+		}
+		if (blocks[idx].live_len == 0)
+			_BlockFree(idx);
+	}
+}
+
 void CompressStorage::Compress()
 {
+#ifdef COMPRESSMAP_STATS
+	uint64_t start = compress_stats_now();
+#endif
+	// ̫ٵblock
+	_Compact();
+
 	// ѹ
 	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
 	{
 		_BlockCompress(&(*it));
 	}
+#ifdef COMPRESSMAP_STATS
+	compress_stats_time(start, stats.compress_us);
+#endif
 
 	// ڴ
 // 	typedef std::vector <Pointer*>		PointerVec;
@@ -299,17 +541,17 @@ void CompressStorage::Compress()
 // 	blocks.resize(new_idx + 1);
 }
 
-int CompressStorage::QueryBytes()
+int64_t CompressStorage::QueryBytes()
 {
-	int ret = 0;
+	int64_t ret = 0;
 	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
 		ret += it->w_off + it->old_len;
 	return ret;
 }
 
-int CompressStorage::QueryCBytes()
+int64_t CompressStorage::QueryCBytes()
 {
-	int ret = 0;
+	int64_t ret = 0;
 	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
 		ret += it->compress_len;
 	return ret;
@@ -321,4 +563,214 @@ void CompressStorage::Clear()
 	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
 		_BlockClear(&(*it));
 	blocks.clear();
+	free_blocks.clear();
+	next_key = 1;
+	cached_idx = -1;
+	write_idx = -1;
+#ifdef COMPRESSMAP_STATS
+	stats.dead_bytes = 0;
+#endif
+}
+
+void CompressStorage::QueryStats( compress_map_stats& out )
+{
+#ifdef COMPRESSMAP_STATS
+	out = stats;
+#else
+	memset(&out, 0, sizeof(out));
+#endif
+	out.stored_bytes = 0;
+	out.compressed_bytes = 0;
+	out.block_count = blocks.size() - free_blocks.size();
+	out.compressed_block_count = 0;
+	memset(out.block_ratio_hist, 0, sizeof(out.block_ratio_hist));
+	for (_BlockVec::iterator it = blocks.begin(); it != blocks.end(); ++ it)
+	{
+		out.stored_bytes += it->w_off + it->old_len;
+		out.compressed_bytes += it->compress_len;
+		if (it->cbuf == NULL || it->old_len <= 0)
+			continue;
+		++ out.compressed_block_count;
+		int bucket = (int)(it->compress_len * kCompressStatsRatioBuckets / it->old_len);
+		++ out.block_ratio_hist[std::min(bucket, kCompressStatsRatioBuckets - 1)];
+	}
+}
+
+void CompressStorage::ResetStats()
+{	// counters only, dead_bytes describes the blocks and stays
+#ifdef COMPRESSMAP_STATS
+	uint64_t dead_bytes = stats.dead_bytes;
+	memset(&stats, 0, sizeof(stats));
+	stats.dead_bytes = dead_bytes;
+#endif
+}
+
+CompressColdTier::CompressColdTier( int idle_seconds /*= 300*/, int bufsize /*= 0*/ )
+	: storage(bufsize)
+{
+	this->idle_seconds = idle_seconds;
+	next_handle = 1;
+	hot_bytes = 0;
+}
+
+CompressColdTier::~CompressColdTier()
+{
+	Clear();
+}
+
+int64_t CompressColdTier::Insert( const char* src, int64_t src_len )
+{
+	int64_t handle = next_handle ++;
+	_Entry& entry = entries[handle];
+	entry.hot.assign(src, (size_t)src_len);
+	entry.storage_key = 0;
+	entry.touch = time(NULL);
+	entry.lru = hot_list.insert(hot_list.end(), handle);
+	hot_bytes += src_len;
+	return handle;
+}
+
+void CompressColdTier::Remove( int64_t handle )
+{
+	_EntryMap::iterator it = entries.find(handle);
+	if (it == entries.end())
+		return;
+
+	_Entry& entry = it->second;
+	if (entry.storage_key)
+		storage.Remove(entry.storage_key);
+	else
+	{
+		hot_bytes -= (int64_t)entry.hot.size();
+		hot_list.erase(entry.lru);
+	}
+	entries.erase(it);
+}
+
+void CompressColdTier::Clear()
+{
+	entries.clear();
+	hot_list.clear();
+	storage.Clear();
+	hot_bytes = 0;
+}
+
+CompressColdTier::_Entry* CompressColdTier::_Access( int64_t handle )
+{
+	// promote if cold, then mark as the most recently used
+	_EntryMap::iterator it = entries.find(handle);
+	if (it == entries.end())
+		return NULL;
+
+	_Entry& entry = it->second;
+	if (entry.storage_key)
+	{
+		// decompress back to hot
+		CompressStorage::Pointer pos = storage.Query(entry.storage_key);
+		entry.hot.resize((size_t)pos.len);
+		if (pos.len > 0 && storage.Read(entry.storage_key, 0, &entry.hot[0], pos.len) != pos.len)
+		{
+			std::string().swap(entry.hot);
+			return NULL;
+		}
+		storage.Remove(entry.storage_key);
+		entry.storage_key = 0;
+		entry.lru = hot_list.insert(hot_list.end(), handle);
+		hot_bytes += pos.len;
+	}
+	else
+		hot_list.splice(hot_list.end(), hot_list, entry.lru);
+
+	entry.touch = time(NULL);
+	return &entry;
+}
+
+bool CompressColdTier::Get( int64_t handle, std::string& out )
+{
+	_Entry* entry = _Access(handle);
+	if (entry == NULL)
+		return false;
+	out = entry->hot;
+	return true;
+}
+
+int64_t CompressColdTier::Read( int64_t handle, int64_t off, char* dst, int64_t len )
+{
+	// copy [off, off + len) of the value, like CompressStorage::Read
+	_Entry* entry = _Access(handle);
+	if (entry == NULL || off < 0 || off >= (int64_t)entry->hot.size() || len <= 0)
+		return 0;
+	len = std::min(len, (int64_t)entry->hot.size() - off);
+	memcpy(dst, entry->hot.data() + off, (size_t)len);
+	return len;
+}
+
+bool CompressColdTier::Set( int64_t handle, const char* src, int64_t src_len )
+{
+	_EntryMap::iterator it = entries.find(handle);
+	if (it == entries.end())
+		return false;
+
+	_Entry& entry = it->second;
+	if (entry.storage_key)
+	{
+		storage.Remove(entry.storage_key);
+		entry.storage_key = 0;
+		entry.lru = hot_list.insert(hot_list.end(), handle);
+	}
+	else
+	{
+		hot_bytes -= (int64_t)entry.hot.size();
+		hot_list.splice(hot_list.end(), hot_list, entry.lru);
+	}
+	entry.hot.assign(src, (size_t)src_len);
+	entry.touch = time(NULL);
+	hot_bytes += src_len;
+	return true;
+}
+
+int CompressColdTier::Demote( time_t now /*= 0*/ )
+{
+	if (now == 0)
+		now = time(NULL);
+
+	// hot_list is in access order, stop at the first entry still in use
+	int count = 0;
+	while (!hot_list.empty())
+	{
+		_Entry& entry = entries[hot_list.front()];
+		if (now - entry.touch < idle_seconds)
+			break;
+
+		entry.storage_key = storage.Insert(entry.hot.c_str(), (int64_t)entry.hot.size());
+		hot_bytes -= (int64_t)entry.hot.size();
+		std::string().swap(entry.hot); // release memory
+		hot_list.pop_front();
+		++ count;
+	}
+
+	if (count > 0)
+		storage.Compress();
+	return count;
+}
+
+int64_t CompressColdTier::QueryLen( int64_t handle )
+{
+	// -1 if absent, cold values are not promoted
+	_EntryMap::iterator it = entries.find(handle);
+	if (it == entries.end())
+		return -1;
+	if (it->second.storage_key)
+		return storage.Query(it->second.storage_key).len;
+	return (int64_t)it->second.hot.size();
+}
+
+int64_t CompressColdTier::QueryHotBytes()
+{
+	return hot_bytes;
+}
+
+int64_t CompressColdTier::QueryColdBytes()
+{
+	return storage.QueryCBytes();
 }
\ No newline at end of file
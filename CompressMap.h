@@ -13,14 +13,138 @@
 #define __COMPRESSMAP_H__
 
 #include <map>
+#include <list>
+#include <ctime>
+#include <memory>
+#include <string>
 #include <vector>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
 #include <algorithm>
+#ifdef COMPRESSMAP_STATS
+#include <chrono>
+#endif
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define COMPRESSMAP_PREFETCH(p)		_mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define COMPRESSMAP_PREFETCH(p)		__builtin_prefetch(p)
+#endif
+
+const int kCompressBlockBufSize = 16*1024;
+const int kCompressMultiGetGroup = 8;	// multi_getͬʱƽĶֲҸ
+const int kCompressStatsTimeBuckets = 20;
+const int kCompressStatsRatioBuckets = 10;
+const int kCompressCompactRatio = 4;	// ݲ1/4ѹblockCompressʱ
+
+/**
+ * compress_map_stats
+ *
+ * CompressStorageCompressLazyMapͳƣQueryStatsȡһݿգԶڲɼ
+ * ʱֽڼֻڶCOMPRESSMAP_STATSʱۼƣΪ0·ûκο
+ * COMPRESSMAP_STATSıĴСб뵥ԪҪһ£cmakeѡMDS_COMPRESSMAP_STATS
+ * blockѹʷֲɵǰblocks㣬Ч
+ * ʱֱͼiΪ[2^i, 2^(i+1))΢룬01΢
+ */
+struct compress_map_stats
+{
+	uint64_t	decompress_count;		// ѹblock
+	uint64_t	decompress_us;			// ѹܺʱ
+	uint64_t	decompress_hist[kCompressStatsTimeBuckets];
+	uint64_t	reuse_hit;				// GetDataʱblockѾǽѹ״̬
+	uint64_t	reuse_miss;				// GetDataʱҪѹ
+	uint64_t	inflated_bytes;			// ѹֽ
+	uint64_t	read_bytes;				// GetDataȡߵֽ
+	uint64_t	compress_count;			// ѹblock
+	uint64_t	compress_us;			// Compress()ܺʱ
+	uint64_t	sort_count;				// CompressLazyMap::sort
+	uint64_t	sort_us;				// sort()ܺʱеCompress
+	uint64_t	dead_bytes;				// RemoveȻռblockֽ
+	uint64_t	stored_bytes;			// blocksδѹݣͬQueryBytes
+	uint64_t	compressed_bytes;		// ͬQueryCBytes
+	uint64_t	block_count;
+	uint64_t	compressed_block_count;
+	uint64_t	block_ratio_hist[kCompressStatsRatioBuckets];	// ѹ/ѹǰiΪ[i/10, (i+1)/10)
+
+	double inflate_per_read() const { return read_bytes ? (double)inflated_bytes / read_bytes : 0; }
+	double reuse_ratio() const { return reuse_hit + reuse_miss ? (double)reuse_hit / (reuse_hit + reuse_miss) : 0; }
+	double dead_ratio() const { return stored_bytes ? (double)dead_bytes / stored_bytes : 0; }
+	double compress_ratio() const { return stored_bytes ? (double)compressed_bytes / stored_bytes : 0; }
+};
+
+#ifdef COMPRESSMAP_STATS
+inline uint64_t compress_stats_now()
+{	// nanoseconds
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void compress_stats_time(uint64_t start, uint64_t& total_us, uint64_t* hist = NULL)
+{	// add the time since start, in microseconds
+	uint64_t us = (compress_stats_now() - start) / 1000;
+	total_us += us;
+	if (hist == NULL)
+		return;
+	int bucket = 0;
+	while (us > 1 && bucket < kCompressStatsTimeBuckets - 1)
+	{
+		us >>= 1;
+		++ bucket;
+	}
+	++ hist[bucket];
+}
+#endif
+
+/**
+ * i_buf_allocator
+ *
+ * CompressStorageblock buf/cbufڴԴNULLʱnew[]
+ */
+struct i_buf_allocator
+{
+	virtual char*	allocate(size_t size) = 0;
+	virtual void	deallocate(char* p, size_t size) = 0;
+};
+
+/**
+ * TBufAllocator
+ *
+ * stlallocatorTAllocatorTPoolAllocatorȣװi_buf_allocator
+ */
+template <typename A>
+class TBufAllocator : public i_buf_allocator
+{
+public:
+	typedef typename std::allocator_traits<A>::template rebind_alloc<char>	char_allocator;
+	typedef std::allocator_traits<char_allocator>							char_traits;
+
+	TBufAllocator(const A& a = A()) : alloc(a) {}
+
+	char* allocate(size_t size)
+	{
+		return char_traits::allocate(alloc, size);
+	}
+
+	void deallocate(char* p, size_t size)
+	{
+		char_traits::deallocate(alloc, p, size);
+	}
+
+protected:
+	char_allocator	alloc;
+};
 
 /**
  * CompressStorage
  *
  * ѹ洢
- * ڻֻ֧ջ
+ * ÿblock¼ݳȣRemove0ʱͷbuf/cbufblockλб
+ * CompressʱѴݲ1/kCompressCompactRatioѹblockеݰᵽblockͷžblock
+ * keyƫơȶ64λ
+ * blockСгɶΣnextblockУReadʽȡֻѹҪĶ
+ * GetDataNULLGetDataֻڲblockС
+ * GetDataһηʵblockΪѹ״̬VisitBatchblock飬ÿblockֻѹһ
  * ̰߳ȫ
  */
 class CompressStorage
@@ -28,83 +152,227 @@ class CompressStorage
 public:
 	struct Pointer
 	{
-		int		key;
-		int		idx;
-		int		off;
-		int		len;
+		int64_t		key;
+		int64_t		idx;	// ڣһblock
+		int64_t		off;	// blockƫ
+		int64_t		len;	// ܳ
 	};
 
 protected:
 	struct _Block
 	{
-		int		idx;		// blocksλ
-		int		w_off;		// bufдƫ
-		int		old_len;	// δѹ
-		int		compress_len;	// ѹ
-		int		cbuf_len;	// cbuf
+		int64_t	idx;		// blocksλ
+		int64_t	w_off;		// bufдƫ
+		int64_t	old_len;	// δѹ
+		int64_t	compress_len;	// ѹ
+		int64_t	cbuf_len;	// cbuf
 		char*	cbuf;		// (ѹ)
-		int		buf_len;	// buf
+		int64_t	buf_len;	// buf
 		char*	buf;		// (ѹ)
+		int64_t	live_len;	// δRemoveݳȣΪ0ʱblock
+		int64_t	next;		// valueһƬblock-1ʾû
 	};
 
 	typedef std::vector <_Block>		_BlockVec;
-	typedef std::map <int, Pointer>		_PointMap;
+	typedef std::map <int64_t, Pointer>	_PointMap;
 
 public:
-	CompressStorage(int size = 0);
+	CompressStorage(int size = 0, i_buf_allocator* alloc = NULL);
 	~CompressStorage();
 
-	int			Insert(char* src, int src_len);
-	void		Remove(int key);
+	int64_t		Insert(const char* src, int64_t src_len);
+	void		Remove(int64_t key);
 	void		Clear();
-	Pointer		Query(int key);
+	Pointer		Query(int64_t key);
 	void		Compress();
-	char*		GetData(int key);
+	char*		GetData(int64_t key);
 	char*		GetData(Pointer pos);
+	int64_t		Read(int64_t key, int64_t off, char* dst, int64_t len);
+
+	template <typename Visitor>
+	size_t		VisitBatch(const int64_t* keys, size_t count, Visitor visit);
 
-	int			QueryBytes();
-	int			QueryCBytes();
+	int64_t		QueryBytes();
+	int64_t		QueryCBytes();
+	void		QueryStats(compress_map_stats& stats);
+	void		ResetStats();
 
 protected:
 	void		_BlockInit(_Block* block);
-	void		_BlockNew(_Block* block, int size);
-	void		_BlockNewBuf(_Block* block, int size);
-	void		_BlockNewCBuf(_Block* block, int size);
+	_Block*		_BlockPushBack();
+	_Block*		_BlockAcquire();
+	void		_BlockFree(int64_t idx);
+	void		_WriteSmall(const char* src, int64_t src_len, Pointer* ptr);
+	void		_Compact();
+	void		_BlockNew(_Block* block);
+	void		_BlockNewBuf(_Block* block, int64_t size);
+	void		_BlockNewCBuf(_Block* block, int64_t size);
 	void		_BlockClear(_Block* block);
 	void		_BlockClearBuf(_Block* block);
 	void		_BlockClearCBuf(_Block* block);
-	bool		_BlockIsSufficient(_Block* block, int len);
-	bool		_BlockCopy(_Block* block, char* dst, int off, int len);
+	int64_t		_BlockDataLen(_Block* block);
+	bool		_BlockIsSufficient(_Block* block, int64_t len);
+	bool		_BlockCopy(_Block* block, char* dst, int64_t off, int64_t len);
 	bool		_BlockMove(_Block* block, _Block* block_src, Pointer* ptr);
-	bool		_BlockWrite(_Block* block, Pointer* ptr, char* src, int src_len, int w_off = -1);
+	bool		_BlockWrite(_Block* block, Pointer* ptr, const char* src, int64_t src_len, int64_t w_off = -1);
 	bool		_BlockCompress(_Block* block);
 	bool		_BlockUnCompress(_Block* block);
+	char*		_Alloc(int64_t size);
+	void		_Free(char* p, int64_t size);
 
 protected:
+	i_buf_allocator*	buf_alloc;
 	int			default_bufsize;
+	int64_t		next_key;
+	int64_t		cached_idx;	// block kept inflated by GetData
+	int64_t		write_idx;	// block small values are appended to, -1 none
 	_BlockVec	blocks;
+	std::vector <int64_t>	free_blocks;	// recycled slots, Pointer::idx stays stable
 	_PointMap	keymap;
+#ifdef COMPRESSMAP_STATS
+	compress_map_stats	stats;
+#endif
+};
+
+template <typename Visitor>
+size_t CompressStorage::VisitBatch( const int64_t* keys, size_t count, Visitor visit )
+{	// visit(i, data) for every keys[i] found, grouped by block so each block inflates once
+	// data is valid only inside visit, blocks inflated here are dropped after their group
+	std::vector <std::pair <Pointer, size_t> > probes;
+	probes.reserve(count);
+	for (size_t i = 0; i < count; ++ i)
+	{
+		Pointer pos = Query(keys[i]);
+		if (pos.key == keys[i] && pos.len <= default_bufsize)
+			probes.push_back(std::make_pair(pos, i));
+	}
+	struct block_order
+	{
+		bool operator() (const std::pair <Pointer, size_t>& l, const std::pair <Pointer, size_t>& r) const
+		{
+			return l.first.idx < r.first.idx || (l.first.idx == r.first.idx && l.first.off < r.first.off);
+		}
+	};
+	std::sort(probes.begin(), probes.end(), block_order());
+
+	for (size_t g = 0; g < probes.size(); )
+	{
+		int64_t idx = probes[g].first.idx;
+		_Block* block = &blocks[idx];
+		bool inflated = block->buf != NULL;
+#ifdef COMPRESSMAP_STATS
+		if (inflated)
+			++ stats.reuse_hit;
+		else
+			++ stats.reuse_miss;
+#endif
+		_BlockUnCompress(block);
+		for (; g < probes.size() && probes[g].first.idx == idx; ++ g)
+		{
+			if (block->buf == NULL)
+				continue;
+#ifdef COMPRESSMAP_STATS
+			stats.read_bytes += probes[g].first.len;
+#endif
+			visit(probes[g].second, block->buf + probes[g].first.off);
+		}
+		if (!inflated && block->cbuf && idx != cached_idx)
+			_BlockClearBuf(block);
+	}
+	return probes.size();
+}
+
+/**
+ * CompressColdTier
+ *
+ * ȷֲ洢ݲѹidle_secondsûзʵCompressStorage
+ * ʱѹƻ
+ * MultiIndexMMapֶֻκhandleֶηӰ
+ * ݰ˳hot_listϣDemoteֻδʵһȡɨȫ
+ * Read/VisitֱӶݣstringGetout
+ * handleCompressStoragekeyһint64_t
+ * ̰߳ȫ
+ */
+class CompressColdTier
+{
+public:
+	CompressColdTier(int idle_seconds = 300, int bufsize = 0);
+	~CompressColdTier();
+
+	int64_t		Insert(const char* src, int64_t src_len);
+	void		Remove(int64_t handle);
+	void		Clear();
+	bool		Get(int64_t handle, std::string& out);
+	int64_t		Read(int64_t handle, int64_t off, char* dst, int64_t len);
+	bool		Set(int64_t handle, const char* src, int64_t src_len);
+	int			Demote(time_t now = 0);
+
+	template <typename Visitor>
+	bool		Visit(int64_t handle, Visitor visit);
+
+	int64_t		QueryLen(int64_t handle);
+	int64_t		QueryHotBytes();
+	int64_t		QueryColdBytes();
+
+protected:
+	typedef std::list <int64_t>			_HandleList;
+
+	struct _Entry
+	{
+		std::string	hot;			// 
+		int64_t		storage_key;	// storageеkey0ʾ
+		time_t		touch;			// ʱ
+		_HandleList::iterator	lru;	// hot_listеλ
+	};
+
+	typedef std::map <int64_t, _Entry>	_EntryMap;
+
+	_Entry*		_Access(int64_t handle);
+
+protected:
+	int				idle_seconds;
+	int64_t			next_handle;
+	int64_t			hot_bytes;
+	_EntryMap		entries;
+	_HandleList		hot_list;	// handleδʵǰ
+	CompressStorage	storage;
 };
 
+template <typename Visitor>
+bool CompressColdTier::Visit( int64_t handle, Visitor visit )
+{	// visit(const char* data, int64_t len), data is valid only inside visit
+	_Entry* entry = _Access(handle);
+	if (entry == NULL)
+		return false;
+	visit(entry->hot.data(), (int64_t)entry->hot.size());
+	return true;
+}
+
 /**
  * CompressLazyMap
  *
  * ѹmap
  * ֧insert󣬽sortȻfind
+ * AnodesCompressStorageblockڴ
+ * findԴʽתKܺKȽϵͣstring keystring_viewset/emplaceֵ֧ԭع
+ * multi_getңkey֣Ԥȡٰblock飬ÿblockֻѹһ
  */
-template <typename K, typename T>
+template <typename K, typename T, typename A = std::allocator<T> >
 class CompressLazyMap
 {
 public:
-	template <typename K, typename T>
+	template <typename K2, typename T2>
 	struct pair_struct
 	{
-		K							first;	// key
-		int							storage_key;
+		K2							first;	// key
+		int64_t						storage_key;
 
-		pair_struct(const K& k)
+		pair_struct(const K2& k)
 			: first(k), storage_key(0) {}
 
+		pair_struct(K2&& k)
+			: first(std::move(k)), storage_key(0) {}
+
 		bool operator< (const pair_struct& right) const 
 		{
 			if (first == right.first)
@@ -117,15 +385,22 @@ public:
 	typedef K									key_type;
 	typedef T									mapped_type;
 	typedef pair_struct <K, T>					value_type;
-	typedef std::vector <value_type>			container_type;
+	typedef A									allocator_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<value_type>	node_allocator_type;
+	typedef std::vector <value_type, node_allocator_type>	container_type;
 	typedef typename container_type::iterator	iterator;
 	
 public:
-	CompressLazyMap(int size = 0)
-		: storage(size)
+	CompressLazyMap(int size = 0, const allocator_type& alloc = allocator_type())
+		: nodes(node_allocator_type(alloc)), buf_alloc(alloc)
+		, storage(std::max<int>(size > 0 ? size : kCompressBlockBufSize, (int)sizeof(mapped_type)), &buf_alloc)	// a value never spans blocks
 	{
 		ordered = true;
 		fakeptr = (mapped_type*)malloc(sizeof(mapped_type));
+#ifdef COMPRESSMAP_STATS
+		sort_count = 0;
+		sort_us = 0;
+#endif
 	}
 
 	~CompressLazyMap() 
@@ -141,10 +416,13 @@ public:
 		if (ordered || nodes.empty())
 			return;
 
-		container_type new_nodes;
+#ifdef COMPRESSMAP_STATS
+		uint64_t start = compress_stats_now();
+#endif
+		container_type new_nodes(nodes.get_allocator());
 		std::sort(nodes.begin(), nodes.end()); // ordered
-		container_type::iterator it_pre = nodes.begin();
-		for (container_type::iterator it = it_pre + 1; it != nodes.end(); ++ it)
+		typename container_type::iterator it_pre = nodes.begin();
+		for (typename container_type::iterator it = it_pre + 1; it != nodes.end(); ++ it)
 		{
 			if ((*it_pre).first != (*it).first)
 				new_nodes.push_back(*it_pre);
@@ -160,6 +438,28 @@ public:
 		std::swap(new_nodes, nodes);
 		storage.Compress();
 		ordered = true;
+#ifdef COMPRESSMAP_STATS
+		++ sort_count;
+		compress_stats_time(start, sort_us);
+#endif
+	}
+
+	void query_stats(compress_map_stats& stats)
+	{	// storage counters plus the time spent in sort()
+		storage.QueryStats(stats);
+#ifdef COMPRESSMAP_STATS
+		stats.sort_count = sort_count;
+		stats.sort_us = sort_us;
+#endif
+	}
+
+	void reset_stats()
+	{
+		storage.ResetStats();
+#ifdef COMPRESSMAP_STATS
+		sort_count = 0;
+		sort_us = 0;
+#endif
 	}
 
 	size_type size() const
@@ -184,7 +484,7 @@ public:
 
 	void clear()
 	{	// destroy object and clear
-		for (container_type::iterator it = nodes.begin(); it != nodes.end(); ++ it)
+		for (typename container_type::iterator it = nodes.begin(); it != nodes.end(); ++ it)
 			destroy(get(it)); // important!!!
 		nodes.clear();
 		storage.Clear();
@@ -201,22 +501,60 @@ public:
 
 	void set(const key_type& _Keyval, const mapped_type& _Mapval)
 	{	// find element matching _Keyval or insert with default mapped
-		if (!ordered)
+		_Set(_Keyval, _Mapval);
+	}
+
+	void set(const key_type& _Keyval, mapped_type&& _Mapval)
+	{
+		_Set(_Keyval, std::move(_Mapval));
+	}
+
+	void set(key_type&& _Keyval, mapped_type&& _Mapval)
+	{
+		_Set(std::move(_Keyval), std::move(_Mapval));
+	}
+
+	template <typename Kx, class... Args>
+	void emplace(Kx&& _Keyval, Args&&... args)
+	{	// set() with the value constructed from args, in place when the key is new
+		iterator _Where = ordered ? _LowerBound(_Keyval) : end();
+		if (_Where != end() && _Keyval == (*_Where).first)
 		{
-			insert(_Keyval, _Mapval);
+			_Replace(_Where, std::forward<Args>(args)...);
 			return;
 		}
+		insert(std::forward<Kx>(_Keyval), std::forward<Args>(args)...);
+		ordered = false;
+	}
 
-		iterator _Where = std::lower_bound(nodes.begin(), nodes.end(), value_type(_Keyval));
-		if (_Where == end() || !(_Keyval == (*_Where).first))
-		{
-			_Where = insert(_Keyval, _Mapval); // unordered
-			ordered = false;
-		}
-		else
-		{
-			*get(_Where) = _Mapval;
-		}
+	template <typename Kx, typename Visitor>
+	size_type multi_get(const Kx* _Keys, size_type _Count, Visitor _Visit)
+	{	// _Visit(i, mapped_type*) for every _Keys[i] found, the pointer is valid only inside _Visit
+		// probes are sorted and searched a group at a time, then fetched block by block
+		if (!ordered || _Count == 0 || nodes.empty())
+			return 0;
+
+		std::vector <size_type> order(_Count);
+		for (size_type i = 0; i < _Count; ++ i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), _ProbeLess<Kx>(_Keys));
+
+		std::vector <int64_t> storage_keys;
+		std::vector <size_type> slots;
+		storage_keys.reserve(_Count);
+		slots.reserve(_Count);
+		_MultiFind(_Keys, order, storage_keys, slots);
+		if (storage_keys.empty())
+			return 0;
+		return storage.VisitBatch(&storage_keys[0], storage_keys.size(), _SlotVisitor<Visitor>(_Visit, slots));
+	}
+
+	template <typename Kx>
+	size_type multi_get(const Kx* _Keys, size_type _Count, mapped_type* _Out, bool* _Found)
+	{	// copy out, _Found[i] tells whether _Out[i] was written
+		for (size_type i = 0; i < _Count; ++ i)
+			_Found[i] = false;
+		return multi_get(_Keys, _Count, _CopyOut(_Out, _Found));
 	}
 
 	mapped_type* get(iterator _Where)
@@ -231,20 +569,164 @@ public:
 
 	iterator find(const key_type& _Keyval)
 	{	// find an element in mutable sequence that matches _Keyval
+		return _Find(_Keyval);
+	}
+
+	template <typename Kx, typename = typename std::enable_if<!std::is_convertible<const Kx&, key_type>::value>::type>
+	iterator find(const Kx& _Keyval)
+	{	// heterogeneous lookup, e.g. std::string key by string_view; implicit conversions use the overload above
+		return _Find(_Keyval);
+	}
+
+protected:
+	template <typename Kx>
+	iterator _Find(const Kx& _Keyval)
+	{
 		if (!ordered)
 			return end();
 
-		iterator _Where = std::lower_bound(nodes.begin(), nodes.end(), value_type(_Keyval));
+		iterator _Where = _LowerBound(_Keyval);
 		return ((_Where == end() || !(_Keyval == (*_Where).first)) ? end() : _Where);
 	}
 
-protected:
-	iterator insert(const key_type& _Keyval, const mapped_type& _Mapval)
+	template <typename Kx>
+	struct _KeyLess
+	{	// node < key without building a value_type
+		bool operator() (const value_type& _Left, const Kx& _Right) const
+		{
+			return _Left.first < _Right;
+		}
+	};
+
+	template <typename Kx>
+	iterator _LowerBound(const Kx& _Keyval)
+	{
+		return std::lower_bound(nodes.begin(), nodes.end(), _Keyval, _KeyLess<Kx>());
+	}
+
+	template <typename Kx>
+	struct _ProbeLess
+	{
+		const Kx*	keys;
+
+		explicit _ProbeLess(const Kx* k) : keys(k) {}
+		bool operator() (size_type _Left, size_type _Right) const
+		{
+			return keys[_Left] < keys[_Right];
+		}
+	};
+
+	template <typename Visitor>
+	struct _SlotVisitor
+	{	// batch index back to the caller's probe index
+		Visitor&						visit;
+		const std::vector <size_type>&	slots;
+
+		_SlotVisitor(Visitor& v, const std::vector <size_type>& s) : visit(v), slots(s) {}
+		void operator() (size_t i, char* data)
+		{
+			visit(slots[i], (mapped_type*)data);
+		}
+	};
+
+	struct _CopyOut
+	{
+		mapped_type*	out;
+		bool*			found;
+
+		_CopyOut(mapped_type* o, bool* f) : out(o), found(f) {}
+		void operator() (size_type i, mapped_type* val)
+		{
+			out[i] = *val;
+			found[i] = true;
+		}
+	};
+
+	template <typename Kx>
+	void _MultiFind(const Kx* _Keys, const std::vector <size_type>& _Order, std::vector <int64_t>& _StorageKeys, std::vector <size_type>& _Slots)
+	{	// lower_bound for sorted probes, kCompressMultiGetGroup searches step in lockstep
+		// and each prefetches its next midpoint, so the cache misses overlap
+		const value_type* first = &nodes[0];
+		const size_type total = nodes.size();
+		size_type lo = 0; // later probes are not smaller, the range only shrinks
+		const value_type* base[kCompressMultiGetGroup];
+		size_type len[kCompressMultiGetGroup];
+
+		for (size_type g = 0; g < _Order.size(); g += kCompressMultiGetGroup)
+		{
+			size_type m = std::min <size_type>(kCompressMultiGetGroup, _Order.size() - g);
+			if (lo == total)
+				break;
+			for (size_type j = 0; j < m; ++ j)
+			{
+				base[j] = first + lo;
+				len[j] = total - lo;
+				COMPRESSMAP_PREFETCH(base[j] + len[j] / 2);
+			}
+
+			for (bool active = true; active; )
+			{
+				active = false;
+				for (size_type j = 0; j < m; ++ j)
+				{
+					if (len[j] <= 1)
+						continue;
+					size_type half = len[j] / 2;
+					base[j] = (base[j][half].first < _Keys[_Order[g + j]]) ? base[j] + half : base[j];
+					len[j] -= half;
+					COMPRESSMAP_PREFETCH(base[j] + len[j] / 2);
+					active = true;
+				}
+			}
+
+			for (size_type j = 0; j < m; ++ j)
+			{
+				const Kx& key = _Keys[_Order[g + j]];
+				size_type pos = (base[j] - first) + (base[j]->first < key ? 1 : 0);
+				lo = pos;
+				if (pos == total || !(key == nodes[pos].first))
+					continue;
+				_StorageKeys.push_back(nodes[pos].storage_key);
+				_Slots.push_back(_Order[g + j]);
+			}
+		}
+	}
+
+	template <typename Kx, typename V>
+	void _Set(Kx&& _Keyval, V&& _Mapval)
+	{
+		if (!ordered)
+		{
+			insert(std::forward<Kx>(_Keyval), std::forward<V>(_Mapval));
+			return;
+		}
+
+		iterator _Where = _LowerBound(_Keyval);
+		if (_Where == end() || !(_Keyval == (*_Where).first))
+		{
+			_Where = insert(std::forward<Kx>(_Keyval), std::forward<V>(_Mapval)); // unordered
+			ordered = false;
+		}
+		else
+			_Replace(_Where, std::forward<V>(_Mapval));
+	}
+
+	template <class... Args>
+	void _Replace(iterator _Where, Args&&... args)
+	{	// get() of a compressed block is an inflated copy, writing through it is lost; store a new blob
+		construct(fakeptr, std::forward<Args>(args)...);
+		destroy(get(_Where));
+		storage.Remove((*_Where).storage_key);
+		(*_Where).storage_key = storage.Insert((char*)fakeptr, sizeof(mapped_type));
+	}
+
+	template <typename Kx, class... Args>
+	iterator insert(Kx&& _Keyval, Args&&... args)
 	{	// insert a {key, mapped} value, with hint
-		value_type _Val(_Keyval);
-		construct(fakeptr, _Mapval); // important!!! construct object with share-memory
+		value_type _Val(std::forward<Kx>(_Keyval));
+		construct(fakeptr, std::forward<Args>(args)...); // important!!! construct object with share-memory
 		_Val.storage_key = storage.Insert((char*)fakeptr, sizeof(mapped_type));
-		return nodes.insert(end(), _Val);
+		return nodes.insert(end(), std::move(_Val));
 	}
 
 	void erase(iterator _Where)
@@ -258,9 +740,10 @@ protected:
 		nodes.erase(_Where);
 	}
 
-	void construct(mapped_type* p, const mapped_type &t)
+	template <class... Args>
+	void construct(mapped_type* p, Args&&... args)
 	{	// construct object at _Ptr with value _Val
-		::new ((void *)p) mapped_type(t); 
+		::new ((void *)p) mapped_type(std::forward<Args>(args)...); 
 	}
 
 	void destroy(mapped_type* p) 
@@ -272,8 +755,13 @@ protected:
 protected:
 	container_type	nodes;
 	bool			ordered;
+	TBufAllocator<A>	buf_alloc;
 	CompressStorage	storage;
 	mapped_type*	fakeptr;
+#ifdef COMPRESSMAP_STATS
+	uint64_t		sort_count;
+	uint64_t		sort_us;
+#endif
 };
 
 #endif // __COMPRESSMAP_H__
\ No newline at end of file
@@ -0,0 +1,381 @@
+/*
+@file		ConcurrentMultiIndexMMap.h
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/3
+@brief
+*/
+
+#pragma once
+
+#ifndef __CONCURRENTMULTIINDEXMAP_H__
+#define __CONCURRENTMULTIINDEXMAP_H__
+
+#include <set>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include "MultiIndexMMap.h"
+
+const int kConcurrentReaderSlots = 64;
+
+/**
+ * ConcurrentMultiIndexMMap
+ *
+ * ̶߳дMultiIndexMMap
+ * ÿһѶдֻԼѯд
+ * дд֮䴮
+ * ɾĽڵ㰴epochӳٻգread_guardڼõָһֱЧ
+ * read_guardͬһ߳Ƕףڲ㸴slotslotʱ˻Ϊڼд߲սڵ
+ * modifyΪдʱƣ޸ĶڶĽڵ
+ * ȽϺᱻͬʱãҪ״̬
+ */
+template <typename T>
+class ConcurrentMultiIndexMMap
+{
+public:
+	struct value_compare;
+	struct index_pair;
+	struct index_value_pair;
+	class read_guard;
+
+	typedef size_t														size_type;
+	typedef T															key_type;
+	typedef T															value_type;
+	typedef T*															pointer;
+	typedef T&															reference;
+	typedef i_multi_key_comp<T>											comp_type;
+	typedef comp_type*													comp_pointer;
+	typedef std::list <value_type>										container_type;
+	typedef std::multiset <index_value_pair, value_compare>				index_type;
+	typedef std::list <index_pair>										index_container_type;
+	typedef typename index_container_type::iterator						index_iterator;
+	typedef typename container_type::iterator							iterator;
+	typedef std::unordered_map <pointer, iterator>						node_map;
+
+	struct index_pair
+	{
+		index_type			index;
+		comp_pointer		comp;
+		std::shared_mutex	lock;
+
+		index_pair(comp_pointer c = NULL) : comp(c) {}
+	};
+	struct index_value_pair
+	{
+		pointer			val;
+		comp_pointer	comp;
+
+		index_value_pair(pointer v, comp_pointer c) : val(v), comp(c) {}
+	};
+	struct value_compare
+	{
+		bool operator () (const index_value_pair& ls, const index_value_pair& rs) const
+		{
+			return (*ls.comp)(ls.val, rs.val);
+		}
+	};
+
+	class read_guard
+	{	// pins the current epoch, values found under the guard are not freed
+	public:
+		explicit read_guard(ConcurrentMultiIndexMMap& m) : owner(m), slot(m._Enter()) {}
+		~read_guard() { owner._Leave(slot); }
+
+	private:
+		read_guard(const read_guard&);
+		read_guard& operator=(const read_guard&);
+
+		ConcurrentMultiIndexMMap&	owner;
+		int							slot;
+	};
+
+public:
+	ConcurrentMultiIndexMMap() : epoch(1), count(0), overflow_readers(0)
+	{
+		for (int i = 0; i < kConcurrentReaderSlots; ++ i)
+			slots[i].epoch = 0;
+	}
+
+	~ConcurrentMultiIndexMMap()
+	{
+		clear();
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	size_type size() const
+	{
+		return count;
+	}
+
+	void clear()
+	{	// not safe against running readers
+		std::lock_guard <std::mutex> lock(write_lock);
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			comp_pointer comp = it->comp;
+			delete comp;
+		}
+		index.clear();
+		nodes.clear();
+		storage.clear();
+		retired.clear();
+		retired_epoch.clear();
+		count = 0;
+	}
+
+	index_iterator insert_index(const comp_pointer _Keycomp)
+	{	// add indexes before readers start, the index list itself is not locked
+		if (_Keycomp == NULL)
+			return index.end();
+
+		std::lock_guard <std::mutex> lock(write_lock);
+		index.emplace_back(_Keycomp);
+		index_iterator ret = -- index.end();
+		index_type& key_index = ret->index;
+		for (iterator it = storage.begin(); it != storage.end(); ++ it)
+			key_index.insert(index_value_pair(&(*it), _Keycomp));
+		return ret;
+	}
+
+	pointer insert(const value_type& _Val)
+	{
+		std::lock_guard <std::mutex> lock(write_lock);
+		pointer ptr = _Store(_Val);
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			std::unique_lock <std::shared_mutex> index_lock(it->lock);
+			it->index.insert(index_value_pair(ptr, it->comp));
+		}
+		++ count;
+		return ptr;
+	}
+
+	bool erase(pointer _Pval)
+	{	// unlink from every index, free after all readers have left
+		std::lock_guard <std::mutex> lock(write_lock);
+		typename node_map::iterator _Where = nodes.find(_Pval);
+		if (_Where == nodes.end())
+			return false;
+
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			std::unique_lock <std::shared_mutex> index_lock(it->lock);
+			_Unlink(*it, _Pval);
+		}
+		_Retire(_Where->second);
+		nodes.erase(_Where);
+		-- count;
+		_Reclaim();
+		return true;
+	}
+
+	template <typename Modifier>
+	pointer modify(pointer _Pval, Modifier _Mod)
+	{	// copy on write, returns the new value pointer
+		std::lock_guard <std::mutex> lock(write_lock);
+		typename node_map::iterator _Where = nodes.find(_Pval);
+		if (_Where == nodes.end())
+			return NULL;
+
+		value_type _Val(*_Pval);
+		_Mod(_Val);
+		pointer ptr = _Store(_Val);
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			std::unique_lock <std::shared_mutex> index_lock(it->lock);
+			_Unlink(*it, _Pval);
+			it->index.insert(index_value_pair(ptr, it->comp));
+		}
+		_Retire(_Where->second);
+		nodes.erase(_Where);
+		_Reclaim();
+		return ptr;
+	}
+
+	void reclaim()
+	{
+		std::lock_guard <std::mutex> lock(write_lock);
+		_Reclaim();
+	}
+
+	pointer find(const read_guard& _Guard, const key_type& _Keyval, const index_iterator& _Index)
+	{
+		(void)(_Guard);
+		std::shared_lock <std::shared_mutex> index_lock(_Index->lock);
+		index_type& key_index = _Index->index;
+		typename index_type::iterator it = key_index.find(index_value_pair((pointer)&_Keyval, _Index->comp));
+		if (it == key_index.end())
+			return NULL;
+		return (*it).val;
+	}
+
+	template <typename Visitor>
+	size_type visit(const read_guard& _Guard, const key_type& _KeyvalL, const key_type& _KeyvalR, const index_iterator& _Index, Visitor _Visit)
+	{	// call _Visit(pointer) on [L, R] in index order, holding only this index's read lock
+		(void)(_Guard);
+		const key_type* pkey_l = &_KeyvalL;
+		const key_type* pkey_r = &_KeyvalR;
+		if (!(*_Index->comp)(pkey_l, pkey_r))
+			std::swap(pkey_l, pkey_r);
+
+		std::shared_lock <std::shared_mutex> index_lock(_Index->lock);
+		index_type& key_index = _Index->index;
+		typename index_type::iterator it = key_index.lower_bound(index_value_pair((pointer)pkey_l, _Index->comp));
+		typename index_type::iterator it_end = key_index.upper_bound(index_value_pair((pointer)pkey_r, _Index->comp));
+		size_type visited = 0;
+		for (; it != it_end; ++ it, ++ visited)
+			_Visit((*it).val);
+		return visited;
+	}
+
+protected:
+	struct reader_slot
+	{
+		alignas(64) std::atomic <uint64_t>	epoch;	// 0 means idle
+	};
+
+	struct nested_guard
+	{	// guards this thread holds, per map
+		const ConcurrentMultiIndexMMap*	owner;
+		int								slot;	// -1: overflow, holds overflow_lock shared
+		int								depth;
+	};
+
+	static std::vector <nested_guard>& _Nested()
+	{
+		static thread_local std::vector <nested_guard> nested;
+		return nested;
+	}
+
+	int _Enter()
+	{	// claim a slot with the current epoch, nested guards reuse the outer one
+		std::vector <nested_guard>& nested = _Nested();
+		for (size_t i = 0; i < nested.size(); ++ i)
+		{
+			if (nested[i].owner == this)
+			{
+				++ nested[i].depth;
+				return nested[i].slot;
+			}
+		}
+
+		nested_guard guard = { this, -1, 1 };
+		size_t start = std::hash <std::thread::id>()(std::this_thread::get_id());
+		uint64_t cur = epoch.load();
+		for (int i = 0; i < kConcurrentReaderSlots && guard.slot == -1; ++ i)
+		{
+			int slot = (int)((start + i) % kConcurrentReaderSlots);
+			uint64_t idle = 0;
+			if (slots[slot].epoch.compare_exchange_strong(idle, cur))
+				guard.slot = slot;
+		}
+		if (guard.slot == -1)
+		{	// all slots busy, block reclamation instead of spinning
+			overflow_lock.lock_shared();
+			++ overflow_readers;
+		}
+		nested.push_back(guard);
+		return guard.slot;
+	}
+
+	void _Leave(int _Slot)
+	{
+		std::vector <nested_guard>& nested = _Nested();
+		for (size_t i = 0; i < nested.size(); ++ i)
+		{
+			if (nested[i].owner != this)
+				continue;
+			if (-- nested[i].depth > 0)
+				return;
+			nested.erase(nested.begin() + i);
+			break;
+		}
+
+		if (_Slot >= 0)
+			slots[_Slot].epoch.store(0);
+		else
+		{
+			-- overflow_readers;
+			overflow_lock.unlock_shared();
+		}
+	}
+
+	pointer _Store(const value_type& _Val)
+	{
+		storage.push_back(_Val);
+		iterator _Where = -- storage.end();
+		pointer ptr = &(*_Where);
+		nodes[ptr] = _Where;
+		return ptr;
+	}
+
+	void _Unlink(index_pair& _Index, pointer _Pval)
+	{	// erase the node holding _Pval, not every equivalent key
+		index_type& key_index = _Index.index;
+		typename index_type::iterator it = key_index.lower_bound(index_value_pair(_Pval, _Index.comp));
+		for (; it != key_index.end(); ++ it)
+		{
+			if ((*it).val == _Pval)
+			{
+				key_index.erase(it);
+				return;
+			}
+			if ((*_Index.comp)(_Pval, (*it).val))
+				return;
+		}
+	}
+
+	void _Retire(iterator _Where)
+	{	// readers entered after this epoch can no longer reach the node
+		uint64_t retire_epoch = epoch.fetch_add(1);
+		retired.splice(retired.end(), storage, _Where);
+		retired_epoch.push_back(retire_epoch);
+	}
+
+	void _Reclaim()
+	{	// free the nodes retired before the oldest active reader
+		if (overflow_readers.load() > 0 || !overflow_lock.try_lock())
+			return; // an overflow reader has no epoch, keep everything until it leaves
+		overflow_lock.unlock(); // readers entering from now on cannot reach retired nodes
+
+		uint64_t oldest = UINT64_MAX;
+		for (int i = 0; i < kConcurrentReaderSlots; ++ i)
+		{
+			uint64_t e = slots[i].epoch.load();
+			if (e != 0 && e < oldest)
+				oldest = e;
+		}
+		while (!retired_epoch.empty() && retired_epoch.front() < oldest)
+		{
+			retired.pop_front();
+			retired_epoch.pop_front();
+		}
+	}
+
+protected:
+	container_type			storage;
+	container_type			retired;
+	std::deque <uint64_t>	retired_epoch;
+	node_map				nodes;
+	index_container_type	index;
+	std::mutex				write_lock;
+	std::atomic <uint64_t>	epoch;
+	std::atomic <size_type>	count;
+	std::atomic <int>		overflow_readers;
+	std::shared_mutex		overflow_lock;	// shared by readers without a slot
+	reader_slot				slots[kConcurrentReaderSlots];
+};
+
+#endif // __CONCURRENTMULTIINDEXMAP_H__
@@ -0,0 +1,256 @@
+/*
+@file		InternedString.h
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/10
+@brief
+*/
+
+#pragma once
+
+#ifndef __INTERNEDSTRING_H__
+#define __INTERNEDSTRING_H__
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include "STLAllocator.h"
+
+const int kInternPoolShards = 16;
+
+/**
+ * interned_string
+ *
+ * ȥصַֻͬȫֻһݣüͷ
+ * ==hashֻȽָ룬O(1)
+ * <ҲָȽϣTinyMapCompressLazyMapkey˳ֵҪֵlexical_less
+ * ڴͳƵStringAllocatorCounter
+ * ̰߳ȫذhashƬֻü
+ */
+class interned_string
+{
+public:
+	interned_string() : rep(NULL) {}
+
+	interned_string(const char* s) : rep(_Intern(s, strlen(s))) {}
+
+	interned_string(const char* s, size_t len) : rep(_Intern(s, len)) {}
+
+	interned_string(const std::string& s) : rep(_Intern(s.c_str(), s.length())) {}
+
+	interned_string(const interned_string& right) : rep(right.rep)
+	{
+		if (rep)
+			rep->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	interned_string(interned_string&& right) : rep(right.rep)
+	{
+		right.rep = NULL;
+	}
+
+	~interned_string()
+	{
+		_Release(rep);
+	}
+
+	interned_string& operator= (const interned_string& right)
+	{
+		if (right.rep)
+			right.rep->refs.fetch_add(1, std::memory_order_relaxed);
+		_Release(rep);
+		rep = right.rep;
+		return *this;
+	}
+
+	interned_string& operator= (interned_string&& right)
+	{
+		if (this != &right)
+		{
+			_Release(rep);
+			rep = right.rep;
+			right.rep = NULL;
+		}
+		return *this;
+	}
+
+	const char* c_str() const
+	{
+		return rep ? rep->data : "";
+	}
+
+	size_t length() const
+	{
+		return rep ? rep->len : 0;
+	}
+
+	size_t size() const
+	{
+		return length();
+	}
+
+	bool empty() const
+	{
+		return rep == NULL;
+	}
+
+	size_t hash() const
+	{
+		return std::hash<const void*>()(rep);
+	}
+
+	operator std::string() const
+	{
+		return std::string(c_str(), length());
+	}
+
+	bool operator== (const interned_string& right) const { return rep == right.rep; }
+	bool operator!= (const interned_string& right) const { return rep != right.rep; }
+	bool operator< (const interned_string& right) const { return std::less<const _Rep*>()(rep, right.rep); }
+
+	struct lexical_less
+	{
+		bool operator() (const interned_string& left, const interned_string& right) const
+		{	// by bytes and length, embedded NULs included
+			if (left == right)
+				return false;
+			size_t left_len = left.length(), right_len = right.length();
+			int ret = memcmp(left.c_str(), right.c_str(), std::min(left_len, right_len));
+			return ret < 0 || (ret == 0 && left_len < right_len);
+		}
+	};
+
+	static size_t pool_size()
+	{	// number of distinct strings alive
+		size_t count = 0;
+		for (int i = 0; i < kInternPoolShards; ++ i)
+		{
+			_Shard& shard = _Pool()[i];
+			std::lock_guard<std::mutex> guard(shard.lock);
+			count += shard.strings.size();
+		}
+		return count;
+	}
+
+protected:
+	struct _Rep
+	{
+		std::atomic<int>	refs;
+		size_t				hash;
+		size_t				len;
+		char				data[1];	// len + 1 bytes
+	};
+
+	struct _Key
+	{
+		const char*	data;
+		size_t		len;
+		size_t		hash;
+	};
+
+	struct _KeyHash
+	{
+		size_t operator() (const _Key& key) const { return key.hash; }
+	};
+
+	struct _KeyEqual
+	{
+		bool operator() (const _Key& left, const _Key& right) const
+		{
+			return left.len == right.len && memcmp(left.data, right.data, left.len) == 0;
+		}
+	};
+
+	typedef TAllocator<std::pair<const _Key, _Rep*>, std::string>				_MapAllocator;
+	typedef std::unordered_map<_Key, _Rep*, _KeyHash, _KeyEqual, _MapAllocator>	_StringMap;
+
+	struct _Shard
+	{
+		std::mutex	lock;
+		_StringMap	strings;
+	};
+
+	static _Shard* _Pool()
+	{	// never destroyed, static interned_string may outlive it otherwise
+		static _Shard* shards = new _Shard[kInternPoolShards];
+		return shards;
+	}
+
+	static size_t _Hash(const char* s, size_t len)
+	{	// FNV-1a
+		size_t h = (size_t)14695981039346656037ULL;
+		for (size_t i = 0; i < len; ++ i)
+			h = (h ^ (unsigned char)s[i]) * (size_t)1099511628211ULL;
+		return h;
+	}
+
+	static _Rep* _Intern(const char* s, size_t len)
+	{
+		if (len == 0)
+			return NULL;
+
+		_Key key = { s, len, _Hash(s, len) };
+		_Shard& shard = _Pool()[key.hash % kInternPoolShards];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		_StringMap::iterator it = shard.strings.find(key);
+		if (it != shard.strings.end())
+		{
+			it->second->refs.fetch_add(1, std::memory_order_relaxed);
+			return it->second;
+		}
+
+		_Rep* rep = (_Rep*)StringAllocator().allocate(offsetof(_Rep, data) + len + 1);
+		new (&rep->refs) std::atomic<int>(1);
+		rep->hash = key.hash;
+		rep->len = len;
+		memcpy(rep->data, s, len);
+		rep->data[len] = 0;
+
+		key.data = rep->data;
+		shard.strings[key] = rep;
+		return rep;
+	}
+
+	static void _Release(_Rep* rep)
+	{
+		if (rep == NULL)
+			return;
+
+		int refs = rep->refs.load(std::memory_order_relaxed);
+		while (refs > 1)
+		{
+			if (rep->refs.compare_exchange_weak(refs, refs - 1))
+				return;
+		}
+
+		// maybe the last reference, drop it under the shard lock so _Intern cannot revive it
+		_Shard& shard = _Pool()[rep->hash % kInternPoolShards];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		if (rep->refs.fetch_sub(1) != 1)
+			return;
+		_Key key = { rep->data, rep->len, rep->hash };
+		shard.strings.erase(key);
+		StringAllocator().deallocate((char*)rep, offsetof(_Rep, data) + rep->len + 1);
+	}
+
+protected:
+	_Rep*	rep;
+};
+
+namespace std {
+	template <>
+	struct hash<interned_string>
+	{
+		size_t operator() (const interned_string& s) const
+		{
+			return s.hash();
+		}
+	};
+}
+
+#endif // __INTERNEDSTRING_H__
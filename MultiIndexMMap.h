@@ -14,29 +14,86 @@
 
 #include <set>
 #include <map>
+#include <list>
+#include <memory>
 #include <vector>
 #include <cassert>
 #include <algorithm>
+#include <thread>
+#include <exception>
+#include <cstdio>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
 
 
 /**
  * MultiIndexMMap
  *
  * ֶ֧setڲάͬڵupdate
+ * modifyԭ޸Ľڵ㣬ֻkey˳ʧЧ
+ * insert׷ݣٶÿ幹allocator̰߳ȫʱУmulti_index_parallel_allocator
+ * deferredģʽΪdirtyͬʱգָɾݵĽڵ㣩һβѯʱؽ
+ * йʱ̵߳쳣join׳ʧܵΪdirty´βѯʱؽ
+ * queryֶ֧Χ󽻣СķΧɨ
+ * save/loadգݺÿ˳кţֱ̣load˳hintĩβO(1)ñȽϺ
+ * loadȶʱļСкУͨ滻ݣʧʱԭݲ䣻load(file, true)У˳ͱȽϺǷ
+ * AΪallocatorÿmultisetrebind
  * ֧equal_rangeΧ
+ * find/lower_bound/upper_bound/equal_rangeԴkeyȽϺֱkeyңùvalue_type
  * ڴ濪ȶmapʡ
  * ʵݴ˳
  *
  * TODO:
  *	storageȥ
  */
+const size_t kMultiIndexParallelBuildSize = 16*1024;
+
+/**
+ * йʱÿԼ߳multisetڵ㣬ֻ̰߳ȫallocator
+ * TArena̰߳ȫģTPoolAllocatorfree lisṭ߳TAllocatorbudgetصڹ߳ϣĬ϶й
+ * ̰߳ȫallocatorػΪtrue_type
+ */
+template <typename A>
+struct multi_index_parallel_allocator : std::false_type {};
+
+template <typename U>
+struct multi_index_parallel_allocator <std::allocator<U> > : std::true_type {};
+const uint32_t kMultiIndexSnapshotMagic = 0x534D494D; // "MIMS"
+const uint32_t kMultiIndexSnapshotVersion = 1;
+
+/**
+ * snapshotļʽţֱmmap
+ * header | rows[row_count] | index0 ordinals[row_count] | index1 ordinals ...
+ */
+struct multi_index_snapshot_header
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	value_size;
+	uint32_t	index_count;
+	uint64_t	row_count;
+};
+
 template <typename T>
 struct i_multi_key_comp
 {
+	virtual ~i_multi_key_comp() {}
 	virtual bool operator () (const T* lp, const T* rp) = 0;
 };
 
-template <typename T>
+template <typename Kx, typename KeyComp>
+struct multi_index_key_probe
+{	// a bare key for heterogeneous lookups, compared by KeyComp(const T*, const Kx&) and KeyComp(const Kx&, const T*)
+	const Kx*	key;
+	KeyComp*	comp;
+
+	multi_index_key_probe(const Kx& k, KeyComp& c) : key(&k), comp(&c) {}
+};
+
+template <typename T, typename A = std::allocator<T> >
 class MultiIndexMMap
 {
 public:
@@ -44,6 +101,7 @@ public:
 	struct index_pair;
 	struct index_value_pair;
 	struct index_value_iterator;
+	struct index_range;
 
 	typedef size_t														size_type;
 	typedef T															key_type;
@@ -52,19 +110,33 @@ public:
 	typedef T&															reference;
 	typedef i_multi_key_comp<T>											comp_type;
 	typedef comp_type*													comp_pointer;
-	typedef std::list <value_type>										container_type;
-	typedef std::multiset <index_value_pair, value_compare>				index_type;
-	typedef std::list <index_pair>										index_container_type;
+	typedef A															allocator_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<index_value_pair>	index_allocator_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<index_pair>		index_pair_allocator_type;
+	typedef std::list <value_type, allocator_type>						container_type;
+	typedef std::multiset <index_value_pair, value_compare, index_allocator_type>	index_type;
+	typedef std::list <index_pair, index_pair_allocator_type>			index_container_type;
 	typedef std::pair<index_value_iterator, index_value_iterator>		index_value_it_pair;
 	typedef typename index_container_type::iterator						index_iterator;
 	typedef typename container_type::iterator							iterator;
+	typedef std::vector <index_range>									index_range_vec;
 
 	struct index_pair
 	{
 		index_type		index;
 		comp_pointer	comp;
+		bool			dirty;	// deferred, rebuild before query
+
+		index_pair(comp_pointer c = NULL, const index_allocator_type& a = index_allocator_type())
+			: index(value_compare(), a), comp(c), dirty(false) {}
+	};
+	struct index_range
+	{	// [low, high] on one index, keys held by value so temporaries are fine
+		index_iterator	index;
+		key_type		low;
+		key_type		high;
 
-		index_pair(comp_pointer c = NULL) : comp(c) {}
+		index_range(const index_iterator& i, const key_type& l, const key_type& h) : index(i), low(l), high(h) {}
 	};
 	struct index_value_pair
 	{
@@ -75,10 +147,24 @@ public:
 	};
 	struct value_compare
 	{
+		typedef void is_transparent;
+
 		bool operator () (const index_value_pair& ls, const index_value_pair& rs) const
 		{
 			return (*ls.comp)(ls.val, rs.val);
 		}
+
+		template <typename Kx, typename KeyComp>
+		bool operator () (const index_value_pair& ls, const multi_index_key_probe<Kx, KeyComp>& rs) const
+		{
+			return (*rs.comp)((const T*)ls.val, *rs.key);
+		}
+
+		template <typename Kx, typename KeyComp>
+		bool operator () (const multi_index_key_probe<Kx, KeyComp>& ls, const index_value_pair& rs) const
+		{
+			return (*ls.comp)(*ls.key, (const T*)rs.val);
+		}
 	};
 	struct index_value_iterator : public index_type::iterator
 	{
@@ -113,20 +199,28 @@ public:
 		{
 			if (index_it != _Right.index_it)
 				assert(false);
-			return base_iterator::operator==(_Right);
+			return static_cast<const base_iterator&>(*this) == _Right;
 		}
 
 		bool operator!=(const index_value_iterator& _Right) const
 		{
 			if (index_it != _Right.index_it)
 				assert(false);
-			return base_iterator::operator!=(_Right);
+			return !(static_cast<const base_iterator&>(*this) == _Right);
 		}
 	};
 
 
 public:
-	MultiIndexMMap() {}
+	MultiIndexMMap() : deferred(false) {}
+	explicit MultiIndexMMap(const allocator_type& _Alloc)
+		: storage(_Alloc), index(index_pair_allocator_type(_Alloc)), deferred(false) {}
+
+	allocator_type get_allocator() const
+	{
+		return storage.get_allocator();
+	}
+
 	~MultiIndexMMap()
 	{
 		clear();
@@ -157,6 +251,8 @@ public:
 	{
 		for (index_iterator it = index.begin(); it != index.end(); ++ it)
 		{
+			if (it->dirty)
+				continue;
 			index_type& index = it->index;
 			index.erase(index_value_pair(&(*_Where), it->comp));
 		}
@@ -167,6 +263,8 @@ public:
 	{
 		for (index_iterator it = index.begin(); it != index.end(); ++ it)
 		{
+			if (it->dirty)
+				continue;
 			index_type& index = it->index;
 			index.erase(index_value_pair(_Pval, it->comp));
 		}
@@ -183,6 +281,7 @@ public:
 
 	pointer find(const key_type& _Keyval, const index_iterator& _Index)
 	{
+		_CheckIndex(_Index);
 		index_type& key_index = (*_Index).index;
 		typename index_type::iterator it = key_index.find(index_value_pair((pointer)&_Keyval, (*_Index).comp));
 		if (it == key_index.end())
@@ -190,27 +289,96 @@ public:
 		return (*it).val;
 	}
 
+	template <typename Kx, typename KeyComp>
+	pointer find(const Kx& _Keyval, const index_iterator& _Index, KeyComp _Comp)
+	{	// find by a bare key, _Comp must order the same way as the index
+		_CheckIndex(_Index);
+		index_type& key_index = (*_Index).index;
+		typename index_type::iterator it = key_index.find(multi_index_key_probe<Kx, KeyComp>(_Keyval, _Comp));
+		if (it == key_index.end())
+			return NULL;
+		return (*it).val;
+	}
+
 	index_iterator insert_index(const comp_pointer _Keycomp)
 	{
 		if (_Keycomp == NULL)
 			return index.end();
 
-		index_iterator ret = index.insert(index.end(), index_pair(_Keycomp));
-		index_type& key_index = ret->index;
-		for (typename container_type::iterator it = storage.begin(); it != storage.end(); ++ it)
-			key_index.insert(index_value_pair(&(*it), _Keycomp));
+		index_iterator ret = index.insert(index.end(), index_pair(_Keycomp, index_allocator_type(storage.get_allocator())));
+		if (deferred)
+			_MarkDirty(*ret);
+		else
+			_BuildIndex(&(*ret), storage.begin());
 		return ret;
 	}
 
 	void insert(const value_type& _Val)
 	{
 		storage.push_back(_Val);
+		_InsertNode(&storage.back());
+	}
+
+	void insert(value_type&& _Val)
+	{
+		storage.push_back(std::move(_Val));
+		_InsertNode(&storage.back());
+	}
+
+	template <class... Args>
+	pointer emplace(Args&&... args)
+	{	// construct the value in its list node
+		storage.emplace_back(std::forward<Args>(args)...);
 		pointer ptr = &storage.back();
+		_InsertNode(ptr);
+		return ptr;
+	}
+
+	template <typename InputIterator>
+	void insert(InputIterator _First, InputIterator _Last)
+	{	// bulk load, append all values then build each index once
+		bool was_empty = storage.empty();
+		iterator _Pre = was_empty ? storage.end() : -- storage.end();
+		storage.insert(storage.end(), _First, _Last);
+		iterator _New = was_empty ? storage.begin() : ++ _Pre;
+		if (_New == storage.end())
+			return;
+
+		std::vector <index_pair*> builds;
 		for (index_iterator it = index.begin(); it != index.end(); ++ it)
 		{
-			index_type& index = it->index;
-			index.insert(index_value_pair(ptr, it->comp));
+			if (deferred)
+				_MarkDirty(*it);
+			if (!it->dirty)
+				builds.push_back(&(*it));
+		}
+		_BuildIndexes(builds, _New);
+	}
+
+	bool deferred_index() const
+	{
+		return deferred;
+	}
+
+	void set_deferred_index(bool _Deferred)
+	{	// deferred: inserts only mark indexes dirty, leave deferred rebuilds all
+		deferred = _Deferred;
+		if (!deferred)
+			rebuild_index();
+	}
+
+	void rebuild_index()
+	{	// rebuild all dirty indexes, in parallel
+		std::vector <index_pair*> builds;
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			if (!it->dirty)
+				continue;
+			it->index.clear();
+			it->dirty = false;
+			builds.push_back(&(*it));
 		}
+		_BuildIndexes(builds, storage.begin());
 	}
 
 	void update(pointer _Poldval, const value_type& _Val)
@@ -219,6 +387,38 @@ public:
 		insert(_Val);
 	}
 
+	template <typename Modifier>
+	bool modify(pointer _Pval, Modifier _Mod)
+	{	// modify value in place, reposition only the indexes whose order is broken
+		std::vector <typename index_type::iterator> nodes;
+		nodes.reserve(index.size());
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			if (it->dirty)
+			{
+				nodes.push_back(it->index.end());
+				continue;
+			}
+			typename index_type::iterator _Node = _FindNode(*it, _Pval);
+			if (_Node == it->index.end())
+				return false;
+			nodes.push_back(_Node);
+		}
+
+		_Mod(*_Pval);
+
+		typename std::vector <typename index_type::iterator>::iterator _Node = nodes.begin();
+		for (index_iterator it = index.begin(); it != index.end(); ++ it, ++ _Node)
+		{
+			if (it->dirty || _IsOrdered(*it, *_Node))
+				continue;
+			index_type& index = it->index;
+			index.erase(*_Node);
+			index.insert(index_value_pair(_Pval, it->comp));
+		}
+		return true;
+	}
+
 	iterator begin()
 	{
 		return storage.begin();
@@ -231,33 +431,59 @@ public:
 
 	index_value_iterator begin(const index_iterator& _Index)
 	{
+		_CheckIndex(_Index);
 		index_type& key_index = (*_Index).index;
 		return index_value_iterator(key_index.begin(), _Index);
 	}
 
 	index_value_iterator end(const index_iterator& _Index)
 	{
+		_CheckIndex(_Index);
 		index_type& key_index = (*_Index).index;
 		return index_value_iterator(key_index.end(), _Index);
 	}
 
 	index_value_iterator lower_bound(const key_type& _Keyval, const index_iterator& _Index)
 	{
+		_CheckIndex(_Index);
 		index_type& key_index = (*_Index).index;
 		return index_value_iterator(key_index.lower_bound(index_value_pair((pointer)&_Keyval, (*_Index).comp)), _Index);
 	}
 
 	index_value_iterator upper_bound(const key_type& _Keyval, const index_iterator& _Index)
 	{
+		_CheckIndex(_Index);
 		index_type& key_index = (*_Index).index;
 		return index_value_iterator(key_index.upper_bound(index_value_pair((pointer)&_Keyval, (*_Index).comp)), _Index);
 	}
 
+	template <typename Kx, typename KeyComp>
+	index_value_iterator lower_bound(const Kx& _Keyval, const index_iterator& _Index, KeyComp _Comp)
+	{
+		_CheckIndex(_Index);
+		index_type& key_index = (*_Index).index;
+		return index_value_iterator(key_index.lower_bound(multi_index_key_probe<Kx, KeyComp>(_Keyval, _Comp)), _Index);
+	}
+
+	template <typename Kx, typename KeyComp>
+	index_value_iterator upper_bound(const Kx& _Keyval, const index_iterator& _Index, KeyComp _Comp)
+	{
+		_CheckIndex(_Index);
+		index_type& key_index = (*_Index).index;
+		return index_value_iterator(key_index.upper_bound(multi_index_key_probe<Kx, KeyComp>(_Keyval, _Comp)), _Index);
+	}
+
 	index_value_it_pair equal_range(const key_type& _Keyval, const index_iterator& _Index)
 	{
 		return index_value_it_pair(lower_bound(_Keyval, _Index), upper_bound(_Keyval, _Index));
 	}
 
+	template <typename Kx, typename KeyComp>
+	index_value_it_pair equal_range(const Kx& _Keyval, const index_iterator& _Index, KeyComp _Comp)
+	{
+		return index_value_it_pair(lower_bound(_Keyval, _Index, _Comp), upper_bound(_Keyval, _Index, _Comp));
+	}
+
 	index_value_it_pair equal_range(const key_type& _KeyvalL, const key_type& _KeyvalR, const index_iterator& _Index)
 	{
 		const key_type* pkey_l = &_KeyvalL;
@@ -267,6 +493,172 @@ public:
 		return index_value_it_pair(lower_bound(*pkey_l, _Index), upper_bound(*pkey_r, _Index));
 	}
 
+	size_type query(const index_range_vec& _Ranges, std::vector <pointer>& _Result)
+	{	// values matching every range, scan the most selective index and check the others
+		typedef typename index_type::iterator base_iterator;
+		size_type count = _Ranges.size();
+		if (count == 0)
+			return 0;
+
+		std::vector <base_iterator> firsts, lasts;
+		std::vector <const key_type*> lows, highs;
+		for (size_type i = 0; i < count; ++ i)
+		{
+			const index_range& range = _Ranges[i];
+			const key_type* pkey_l = &range.low;
+			const key_type* pkey_r = &range.high;
+			if (!(*range.index->comp)(pkey_l, pkey_r))
+				std::swap(pkey_l, pkey_r);
+			firsts.push_back(lower_bound(*pkey_l, range.index));
+			lasts.push_back(upper_bound(*pkey_r, range.index));
+			lows.push_back(pkey_l);
+			highs.push_back(pkey_r);
+		}
+
+		// estimate, step all ranges together until the smallest one ends, O(K * min)
+		size_type best = count;
+		std::vector <base_iterator> cursors(firsts);
+		while (best == count)
+		{
+			for (size_type i = 0; i < count; ++ i)
+			{
+				if (cursors[i] == lasts[i])
+				{
+					best = i;
+					break;
+				}
+				++ cursors[i];
+			}
+		}
+
+		size_type found = 0;
+		for (base_iterator it = firsts[best]; it != lasts[best]; ++ it)
+		{
+			pointer val = (*it).val;
+			bool match = true;
+			for (size_type i = 0; i < count && match; ++ i)
+			{
+				if (i == best)
+					continue;
+				comp_type& comp = *_Ranges[i].index->comp;
+				match = !comp(val, lows[i]) && !comp(highs[i], val);
+			}
+			if (!match)
+				continue;
+			_Result.push_back(val);
+			++ found;
+		}
+		return found;
+	}
+
+	bool save(const char* _Filename)
+	{	// rows in storage order, then each index as row ordinals
+		static_assert(std::is_trivially_copyable<value_type>::value, "snapshot needs trivially copyable value_type");
+		if (storage.size() > UINT32_MAX)
+			return false;
+
+		FILE* fp = fopen(_Filename, "wb");
+		if (fp == NULL)
+			return false;
+
+		multi_index_snapshot_header header;
+		header.magic = kMultiIndexSnapshotMagic;
+		header.version = kMultiIndexSnapshotVersion;
+		header.value_size = sizeof(value_type);
+		header.index_count = (uint32_t)index.size();
+		header.row_count = storage.size();
+		bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+		std::unordered_map <const value_type*, uint32_t> ordinals;
+		ordinals.reserve(storage.size());
+		uint32_t ordinal = 0;
+		for (iterator it = storage.begin(); ok && it != storage.end(); ++ it)
+		{
+			ordinals[&(*it)] = ordinal ++;
+			ok = fwrite(&(*it), sizeof(value_type), 1, fp) == 1;
+		}
+
+		std::vector <uint32_t> order;
+		for (index_iterator it = index.begin(); ok && it != index.end(); ++ it)
+		{
+			_CheckIndex(it);
+			order.clear();
+			for (typename index_type::iterator it2 = it->index.begin(); it2 != it->index.end(); ++ it2)
+				order.push_back(ordinals[(*it2).val]);
+			ok = order.empty() || fwrite(&order[0], sizeof(uint32_t), order.size(), fp) == order.size();
+		}
+
+		fclose(fp);
+		return ok;
+	}
+
+	bool load(const char* _Filename, bool _Verify = false)
+	{	// indexes must already be inserted, in the same order as when saved; _Verify also checks each index order with its comparator
+		static_assert(std::is_trivially_copyable<value_type>::value, "snapshot needs trivially copyable value_type");
+		FILE* fp = fopen(_Filename, "rb");
+		if (fp == NULL)
+			return false;
+
+		multi_index_snapshot_header header;
+		bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+			header.magic == kMultiIndexSnapshotMagic &&
+			header.version == kMultiIndexSnapshotVersion &&
+			header.value_size == sizeof(value_type) &&
+			header.index_count == index.size() &&
+			header.row_count <= UINT32_MAX &&
+			_FileSize(fp) == sizeof(header) + header.row_count * (sizeof(value_type) + header.index_count * sizeof(uint32_t));
+
+		// read into temporaries, the live data is replaced only when everything checks out
+		container_type rows_storage(storage.get_allocator());
+		std::vector <pointer> rows;
+		if (ok)
+			rows.reserve((size_t)header.row_count);
+		std::vector <value_type> buf(1024);
+		for (uint64_t left = ok ? header.row_count : 0; ok && left > 0; )
+		{
+			size_t n = (size_t)std::min <uint64_t>(left, buf.size());
+			ok = fread(&buf[0], sizeof(value_type), n, fp) == n;
+			for (size_t i = 0; ok && i < n; ++ i)
+			{
+				rows_storage.push_back(buf[i]);
+				rows.push_back(&rows_storage.back());
+			}
+			left -= n;
+		}
+
+		std::vector <index_type> restored;
+		restored.reserve(index.size());
+		std::vector <uint32_t> order(rows.size());
+		std::vector <char> seen;
+		for (index_iterator it = index.begin(); ok && it != index.end(); ++ it)
+		{
+			ok = order.empty() || fread(&order[0], sizeof(uint32_t), order.size(), fp) == order.size();
+			seen.assign(rows.size(), 0);
+			for (size_t i = 0; ok && i < order.size(); ++ i)
+			{	// a permutation of the rows, each exactly once
+				ok = order[i] < rows.size() && !seen[order[i]];
+				if (ok)
+					seen[order[i]] = 1;
+			}
+			restored.push_back(index_type(value_compare(), it->index.get_allocator()));
+			if (ok)
+				ok = _RestoreIndex(*it, restored.back(), rows, order, _Verify);
+		}
+
+		fclose(fp);
+		if (!ok)
+			return false;
+
+		storage.swap(rows_storage); // list nodes keep their addresses
+		typename std::vector <index_type>::iterator it_restored = restored.begin();
+		for (index_iterator it = index.begin(); it != index.end(); ++ it, ++ it_restored)
+		{
+			it->index.swap(*it_restored);
+			it->dirty = false;
+		}
+		return true;
+	}
+
 	// no {key/value}, only value
 // 	value_type& operator[](const key_type& _Keyval)
 // 	{
@@ -287,9 +679,196 @@ public:
 // 		return *(*_Where).val;
 // 	}
 
+protected:
+	void _InsertNode(pointer _Pval)
+	{	// link a new value into every live index
+		for (index_iterator it = index.begin(); it != index.end(); ++ it)
+		{
+			if (deferred)
+				_MarkDirty(*it);
+			if (it->dirty)
+				continue;
+			index_type& index = it->index;
+			index.insert(index_value_pair(_Pval, it->comp));
+		}
+	}
+
+	void _CheckIndex(const index_iterator& _Index)
+	{	// lazy rebuild of a deferred index
+		if (!_Index->dirty)
+			return;
+		_Index->index.clear();
+		_BuildIndex(&(*_Index), storage.begin()); // stays dirty if this throws
+		_Index->dirty = false;
+	}
+
+	void _BuildIndex(index_pair* _Index, iterator _First)
+	{	// sort [_First, end) then merge with the existing order
+		comp_pointer comp = _Index->comp;
+		std::vector <index_value_pair> vals;
+		for (iterator it = _First; it != storage.end(); ++ it)
+			vals.push_back(index_value_pair(&(*it), comp));
+		std::stable_sort(vals.begin(), vals.end(), value_compare());
+
+		index_type& key_index = _Index->index;
+		if (!key_index.empty())
+		{
+			std::vector <index_value_pair> merged;
+			merged.reserve(key_index.size() + vals.size());
+			std::merge(key_index.begin(), key_index.end(), vals.begin(), vals.end(), std::back_inserter(merged), value_compare());
+			std::swap(merged, vals);
+		}
+		index_type sorted_index(vals.begin(), vals.end(), value_compare(), key_index.get_allocator()); // sorted input, linear
+		key_index.swap(sorted_index);
+	}
+
+	void _MarkDirty(index_pair& _Index)
+	{	// drop the nodes now, a dirty index is rebuilt from storage anyway
+		if (_Index.dirty)
+			return;
+		_Index.index.clear();
+		_Index.dirty = true;
+	}
+
+	struct _Joiner
+	{	// a joinable std::thread terminates when destroyed, join on every path
+		std::vector <std::thread>&	threads;
+
+		explicit _Joiner(std::vector <std::thread>& t) : threads(t) {}
+		~_Joiner()
+		{
+			for (size_t i = 0; i < threads.size(); ++ i)
+			{
+				if (threads[i].joinable())
+					threads[i].join();
+			}
+		}
+	};
+
+	void _BuildIndexCaught(index_pair* _Index, iterator _First, std::exception_ptr* _Error)
+	{	// worker thread body, exceptions go back to the caller
+		try
+		{
+			_BuildIndex(_Index, _First);
+		}
+		catch (...)
+		{
+			*_Error = std::current_exception();
+		}
+	}
+
+	void _BuildIndexes(const std::vector <index_pair*>& _Indexes, iterator _First)
+	{	// one thread per index, the last one on the caller; serial unless the allocator is thread-safe
+		if (_Indexes.empty())
+			return;
+		try
+		{
+			if (_Indexes.size() == 1 || storage.size() < kMultiIndexParallelBuildSize || !multi_index_parallel_allocator<A>::value)
+			{
+				for (size_type i = 0; i < _Indexes.size(); ++ i)
+					_BuildIndex(_Indexes[i], _First);
+				return;
+			}
+
+			std::vector <std::exception_ptr> errors(_Indexes.size() - 1);
+			std::vector <std::thread> threads;
+			threads.reserve(_Indexes.size() - 1);
+			{
+				_Joiner joiner(threads);
+				for (size_type i = 0; i + 1 < _Indexes.size(); ++ i)
+					threads.push_back(std::thread(&MultiIndexMMap::_BuildIndexCaught, this, _Indexes[i], _First, &errors[i]));
+				_BuildIndex(_Indexes.back(), _First);
+			}
+			for (size_type i = 0; i < errors.size(); ++ i)
+			{
+				if (errors[i])
+					std::rethrow_exception(errors[i]);
+			}
+		}
+		catch (...)
+		{	// some indexes may miss the new values, rebuild them on next use
+			for (size_type i = 0; i < _Indexes.size(); ++ i)
+			{
+				_Indexes[i]->index.clear();
+				_Indexes[i]->dirty = true;
+			}
+			throw;
+		}
+	}
+
+	struct _AppendComp : comp_type
+	{	// never less, a hint at end() appends without calling the real comparator
+		bool operator () (const T*, const T*) { return false; }
+	};
+
+	bool _RestoreIndex(index_pair& _Index, index_type& _Restored, const std::vector <pointer>& _Rows, const std::vector <uint32_t>& _Order, bool _Verify)
+	{	// saved order appended at end(), O(1) per row, then the real comparator is put back on every node
+		static _AppendComp append;
+		comp_type& comp = *_Index.comp;
+		pointer prev = NULL;
+		for (size_t i = 0; i < _Order.size(); ++ i)
+		{
+			pointer val = _Rows[_Order[i]];
+			if (_Verify && prev && comp(val, prev))
+				return false; // the file does not match the index
+			_Restored.insert(_Restored.end(), index_value_pair(val, &append));
+			prev = val;
+		}
+		for (typename index_type::iterator it = _Restored.begin(); it != _Restored.end(); ++ it)
+			const_cast<index_value_pair&>(*it).comp = _Index.comp; // not part of the ordering
+		return true;
+	}
+
+	static uint64_t _FileSize(FILE* fp)
+	{	// leaves the position where it was
+#if defined(_MSC_VER)
+		__int64 cur = _ftelli64(fp);
+		_fseeki64(fp, 0, SEEK_END);
+		__int64 size = _ftelli64(fp);
+		_fseeki64(fp, cur, SEEK_SET);
+#else
+		off_t cur = ftello(fp);
+		fseeko(fp, 0, SEEK_END);
+		off_t size = ftello(fp);
+		fseeko(fp, cur, SEEK_SET);
+#endif
+		return size < 0 ? 0 : (uint64_t)size;
+	}
+
+	typename index_type::iterator _FindNode(index_pair& _Index, pointer _Pval)
+	{	// find the node holding _Pval, not just an equivalent key
+		index_type& key_index = _Index.index;
+		typename index_type::iterator it = key_index.lower_bound(index_value_pair(_Pval, _Index.comp));
+		for (; it != key_index.end(); ++ it)
+		{
+			if ((*it).val == _Pval)
+				return it;
+			if ((*_Index.comp)(_Pval, (*it).val))
+				break;
+		}
+		return key_index.end();
+	}
+
+	bool _IsOrdered(index_pair& _Index, typename index_type::iterator _Node)
+	{	// check _Node against its neighbours
+		comp_type& comp = *_Index.comp;
+		pointer val = (*_Node).val;
+		if (_Node != _Index.index.begin())
+		{
+			typename index_type::iterator _Prev = _Node;
+			if (comp(val, (*-- _Prev).val))
+				return false;
+		}
+		typename index_type::iterator _Next = _Node;
+		if (++ _Next != _Index.index.end() && comp((*_Next).val, val))
+			return false;
+		return true;
+	}
+
 protected:
 	container_type			storage;
 	index_container_type	index;
+	bool					deferred;
 };
 
 
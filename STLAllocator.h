@@ -13,27 +13,368 @@
 #define __STLALLOCATOR_H__
 
 
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <string>
-#include <xmemory>
+#include <vector>
+#include <cstdio>
+#include <utility>
+#include <cstdlib>
+#include <cstddef>
+#include <typeinfo>
+#include <memory>
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+const int kAllocatorCounterShards = 16;
+const int kAllocatorSizeClasses = 32;
+const size_t kAllocatorPeakCheckBytes = 64 * 1024;
+
+/**
+ * allocator_stats
+ *
+ * TAllocatorCounterͳƿ
+ * size_class[i]ΪС[2^i, 2^(i+1))
+ * peakkAllocatorPeakCheckBytesȲ Ƭ*
+ */
+struct allocator_stats {
+	size_t	mem_total;
+	size_t	class_total;
+	size_t	alloc_count;
+	size_t	free_count;
+	size_t	peak;
+	size_t	size_class[kAllocatorSizeClasses];
+};
+
+/**
+ * allocator_budget_exceeded
+ *
+ * hard budgetʱallocate׳bad_alloc
+ */
+struct allocator_budget_exceeded : public std::bad_alloc {
+	const char* what() const throw() {
+		return "allocator hard budget exceeded";
+	}
+};
+
+inline int allocator_shard_index() { // threads spread over the shards round robin
+	static std::atomic<int> next(0);
+	static thread_local int index = next.fetch_add(1, std::memory_order_relaxed) % kAllocatorCounterShards;
+	return index;
+}
+
+inline int allocator_size_class(size_t bytes) { // floor(log2(bytes))
+	if (bytes == 0)
+		return 0;
+#if defined(__GNUC__)
+	int c = (int)(sizeof(unsigned long long) * 8 - 1 - __builtin_clzll((unsigned long long)bytes));
+#else
+	int c = 0;
+	while (bytes >>= 1)
+		++ c;
+#endif
+	return c < kAllocatorSizeClasses ? c : kAllocatorSizeClasses - 1;
+}
+
+/**
+ * TAllocatorRegistry
+ *
+ * TAllocatorCounterһʹʱԶע
+ * ʱöٷ࣬text/jsonʽĿ
+ * alloc_rateΪһsnapshotÿ
+ */
+class TAllocatorRegistry {
+public:
+	typedef allocator_stats (*stats_func)();
+
+	struct entry {
+		std::string	name;
+		stats_func	stats;
+		size_t		last_allocs;
+	};
+
+	struct report_item {
+		std::string		name;
+		allocator_stats	stats;
+		size_t			live_objects;	// alloc_count - free_count
+		double			alloc_rate;		// allocations per second
+	};
+
+	static TAllocatorRegistry& instance() {
+		static TAllocatorRegistry registry;
+		return registry;
+	}
+
+	bool add(const std::string& name, stats_func stats) {
+		std::lock_guard<std::mutex> guard(lock);
+		entry e;
+		e.name = name;
+		e.stats = stats;
+		e.last_allocs = 0;
+		entries.push_back(e);
+		return true;
+	}
+
+	std::vector<std::string> categories() {
+		std::lock_guard<std::mutex> guard(lock);
+		std::vector<std::string> names;
+		for (size_t i = 0; i < entries.size(); ++ i)
+			names.push_back(entries[i].name);
+		return names;
+	}
+
+	std::vector<report_item> snapshot() {
+		std::lock_guard<std::mutex> guard(lock);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(now - last_snapshot).count();
+		last_snapshot = now;
+
+		std::vector<report_item> items;
+		for (size_t i = 0; i < entries.size(); ++ i) {
+			entry& e = entries[i];
+			report_item item;
+			item.name = e.name;
+			item.stats = e.stats();
+			item.live_objects = item.stats.alloc_count - item.stats.free_count;
+			item.alloc_rate = seconds > 0 ? (item.stats.alloc_count - e.last_allocs) / seconds : 0;
+			e.last_allocs = item.stats.alloc_count;
+			items.push_back(item);
+		}
+		return items;
+	}
+
+	std::string dump_text() {
+		std::vector<report_item> items = snapshot();
+		std::string out;
+		char line[512];
+		snprintf(line, sizeof(line), "%-48s %14s %12s %14s %12s\n", "category", "bytes", "live", "peak", "allocs/s");
+		out += line;
+		for (size_t i = 0; i < items.size(); ++ i) {
+			const report_item& item = items[i];
+			snprintf(line, sizeof(line), "%-48s %14zu %12zu %14zu %12.1f\n", item.name.c_str(),
+				item.stats.mem_total, item.live_objects, item.stats.peak, item.alloc_rate);
+			out += line;
+		}
+		return out;
+	}
+
+	std::string dump_json() {
+		std::vector<report_item> items = snapshot();
+		std::string out = "[";
+		char buf[256];
+		for (size_t i = 0; i < items.size(); ++ i) {
+			const report_item& item = items[i];
+			out += i ? ",{\"name\":\"" : "{\"name\":\"";
+			for (size_t j = 0; j < item.name.size(); ++ j) {
+				char c = item.name[j];
+				if (c == '"' || c == '\\')
+					out += '\\';
+				out += c;
+			}
+			snprintf(buf, sizeof(buf), "\",\"bytes\":%zu,\"live\":%zu,\"peak\":%zu,\"allocs\":%zu,\"frees\":%zu,\"alloc_rate\":%.1f}",
+				item.stats.mem_total, item.live_objects, item.stats.peak, item.stats.alloc_count, item.stats.free_count, item.alloc_rate);
+			out += buf;
+		}
+		out += "]";
+		return out;
+	}
+
+	static std::string type_name(const std::type_info& type) {
+#if defined(__GNUC__)
+		int status = 0;
+		char* demangled = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+		if (status == 0 && demangled) {
+			std::string name(demangled);
+			free(demangled);
+			return name;
+		}
+#endif
+		return type.name();
+	}
+
+private:
+	TAllocatorRegistry() : last_snapshot(std::chrono::steady_clock::now()) {}
+
+	std::mutex								lock;
+	std::vector<entry>						entries;
+	std::chrono::steady_clock::time_point	last_snapshot;
+};
 
 /**
  * TAllocatorCounter
  *
+ * ̷߳Ƭļдֻı̵߳ķƬrelaxedԭӲͬƬcache line
+ * ʱзƬ
+ * ѡsoft/hard budget0Ϊƣ
+ *	softʱصһpressure_callbackصsoftº´ڻصCompress̭
+ *	صڴִ߳ͬУܲڴǸ
+ *	hardʱ׳allocator_budget_exceededڴ
+ *	budgetӱƬδķ㣨ͷŵ̧߹㣩ֻڹԽʱŻзƬ Ƭ*kAllocatorPeakCheckBytes
+ * allocatecheck_budgetɹon_allocoperator new쳣ʱ
  */
 template <typename C>
 struct TAllocatorCounter {
 	typedef size_t		size_type;
+	typedef void (*pressure_callback)(size_type mem_total, void* ctx);
+
+	struct alignas(64) _Shard {
+		std::atomic<ptrdiff_t>	mem;
+		std::atomic<ptrdiff_t>	cls;
+		std::atomic<size_t>		allocs;
+		std::atomic<size_t>		frees;
+		std::atomic<size_t>		unchecked;	// bytes allocated since last peak check, part of the budget estimate
+		std::atomic<size_t>		freed;		// bytes freed under pressure since last re-arm check
+		std::atomic<size_t>		size_class[kAllocatorSizeClasses];
+	};
 
 	static size_type get_mem_size() {
-		return mem_total;
+		ptrdiff_t total = 0;
+		for (int i = 0; i < kAllocatorCounterShards; ++ i)
+			total += shards[i].mem.load(std::memory_order_relaxed);
+		return total > 0 ? (size_type)total : 0;
 	}
 
 	static size_type get_class_size() {
-		return class_total;
+		ptrdiff_t total = 0;
+		for (int i = 0; i < kAllocatorCounterShards; ++ i)
+			total += shards[i].cls.load(std::memory_order_relaxed);
+		return total > 0 ? (size_type)total : 0;
+	}
+
+	static allocator_stats get_stats() {
+		allocator_stats stats = {};
+		stats.mem_total = get_mem_size();
+		stats.class_total = get_class_size();
+		for (int i = 0; i < kAllocatorCounterShards; ++ i) {
+			_Shard& shard = shards[i];
+			stats.alloc_count += shard.allocs.load(std::memory_order_relaxed);
+			stats.free_count += shard.frees.load(std::memory_order_relaxed);
+			for (int j = 0; j < kAllocatorSizeClasses; ++ j)
+				stats.size_class[j] += shard.size_class[j].load(std::memory_order_relaxed);
+		}
+		_UpdatePeak(stats.mem_total);
+		stats.peak = peak.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	static void set_budget(size_type soft, size_type hard) {
+		soft_budget.store(soft);
+		hard_budget.store(hard);
+		_Sample();
+		budgeted.store(soft != 0 || hard != 0);
+		pressure.store(false);
+	}
+
+	static void add_pressure_callback(pressure_callback cb, void* ctx) {
+		std::lock_guard<std::mutex> guard(callback_lock());
+		callbacks().push_back(std::make_pair(cb, ctx));
+	}
+
+	static void check_budget(size_type bytes) { // before allocating, may throw
+		_Register();
+		if (budgeted.load(std::memory_order_relaxed))
+			_CheckBudget(shards[allocator_shard_index()], bytes);
+	}
+
+	static void on_alloc(size_type bytes) { // after the memory is allocated
+		_Register();
+		_Shard& shard = shards[allocator_shard_index()];
+		shard.mem.fetch_add((ptrdiff_t)bytes, std::memory_order_relaxed);
+		shard.allocs.fetch_add(1, std::memory_order_relaxed);
+		shard.size_class[allocator_size_class(bytes)].fetch_add(1, std::memory_order_relaxed);
+		if (shard.unchecked.fetch_add(bytes, std::memory_order_relaxed) + bytes >= kAllocatorPeakCheckBytes) {
+			shard.unchecked.store(0, std::memory_order_relaxed);
+			_UpdatePeak(_Sample());
+		}
+	}
+
+	static void on_free(size_type bytes, size_type count = 1) {
+		_Shard& shard = shards[allocator_shard_index()];
+		shard.mem.fetch_sub((ptrdiff_t)bytes, std::memory_order_relaxed);
+		shard.frees.fetch_add(count, std::memory_order_relaxed);
+		if (!pressure.load(std::memory_order_relaxed))
+			return;
+		// under pressure, look at the total once per kAllocatorPeakCheckBytes freed on this shard
+		// frees have their own counter, unchecked only grows with allocations
+		if (shard.freed.fetch_add(bytes, std::memory_order_relaxed) + bytes < kAllocatorPeakCheckBytes)
+			return;
+		shard.freed.store(0, std::memory_order_relaxed);
+		if (_Sample() <= soft_budget.load(std::memory_order_relaxed))
+			pressure.store(false); // re-arm
+	}
+
+	static void on_construct() {
+		_Register();
+		shards[allocator_shard_index()].cls.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static void on_destroy() {
+		shards[allocator_shard_index()].cls.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+protected:
+	static void _Register() { // join the registry on first use
+		static bool registered = TAllocatorRegistry::instance().add(TAllocatorRegistry::type_name(typeid(C)), &get_stats);
+		(void)(registered);
+	}
+
+	static size_type _Sample() { // exact total, remembered for the budget estimate
+		size_type total = get_mem_size();
+		sampled.store(total, std::memory_order_relaxed);
+		return total;
+	}
+
+	static void _CheckBudget(_Shard& shard, size_type bytes) {
+		// estimate first, every shard is summed only when the estimate crosses a limit
+		size_type total = sampled.load(std::memory_order_relaxed) + shard.unchecked.load(std::memory_order_relaxed) + bytes;
+		size_type hard = hard_budget.load(std::memory_order_relaxed);
+		size_type soft = soft_budget.load(std::memory_order_relaxed);
+		bool over_hard = hard && total > hard;
+		bool over_soft = soft && total > soft && !pressure.load(std::memory_order_relaxed);
+		if (!over_hard && !over_soft)
+			return;
+
+		total = _Sample() + bytes;
+		if (hard && total > hard)
+			throw allocator_budget_exceeded();
+		if (!soft || total <= soft || pressure.exchange(true))
+			return;
+
+		std::vector<std::pair<pressure_callback, void*> > fire;
+		{
+			std::lock_guard<std::mutex> guard(callback_lock());
+			fire = callbacks();
+		}
+		for (size_t i = 0; i < fire.size(); ++ i)
+			fire[i].first(total, fire[i].second);
+	}
+
+	static std::mutex& callback_lock() {
+		static std::mutex lock;
+		return lock;
+	}
+
+	static std::vector<std::pair<pressure_callback, void*> >& callbacks() {
+		static std::vector<std::pair<pressure_callback, void*> > list;
+		return list;
+	}
+
+	static void _UpdatePeak(size_type total) {
+		size_type cur = peak.load(std::memory_order_relaxed);
+		while (total > cur && !peak.compare_exchange_weak(cur, total, std::memory_order_relaxed))
+			;
 	}
 
-	static size_type	mem_total;
-	static size_type	class_total;
+	static _Shard				shards[kAllocatorCounterShards];
+	static std::atomic<size_type>	peak;
+	static std::atomic<size_type>	sampled;	// total at the last sample
+	static std::atomic<size_type>	soft_budget;
+	static std::atomic<size_type>	hard_budget;
+	static std::atomic<bool>		budgeted;
+	static std::atomic<bool>		pressure;
 };
 
 
@@ -47,7 +388,8 @@ struct TAllocatorCounter {
  */
 template <typename T, typename C>
 struct TAllocator {
-	typedef size_t	size_type, difference_type;
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
 	typedef T		value_type;
 	typedef T		*pointer, &reference;
 	typedef const T	*const_pointer, &const_reference;
@@ -56,20 +398,20 @@ struct TAllocator {
 	struct rebind { typedef TAllocator <U, C> other; };
 
 	TAllocator() {
-		++ TAllocatorCounter<C>::class_total;
+		TAllocatorCounter<C>::on_construct();
 	}
 
 	TAllocator(const TAllocator <T, C> &) {
-		++ TAllocatorCounter<C>::class_total;
+		TAllocatorCounter<C>::on_construct();
 	}
 
 	template<class U>
 	TAllocator(const TAllocator<U, C>&) {
-		++ TAllocatorCounter<C>::class_total;
+		TAllocatorCounter<C>::on_construct();
 	}
 
 	~TAllocator() {
-		-- TAllocatorCounter<C>::class_total;
+		TAllocatorCounter<C>::on_destroy();
 	}
 
 	pointer address(reference r) const { return &r; }
@@ -86,16 +428,338 @@ struct TAllocator {
 		p->~T();
 	}
 	pointer allocate(size_type n) { // allocate array of _Count elements
-		TAllocatorCounter<C>::mem_total += n * sizeof(value_type);
-		return (pointer)::operator new(n * sizeof(value_type)); 
+		TAllocatorCounter<C>::check_budget(n * sizeof(value_type));
+		pointer p = (pointer)::operator new(n * sizeof(value_type));
+		TAllocatorCounter<C>::on_alloc(n * sizeof(value_type));
+		return p;
 	}
 	pointer allocate(size_type n, const void *) { // allocate array of _Count elements, ignore hint
 		return (allocate(n));
 	}
 	void deallocate(pointer p, size_type n) { // deallocate object at _Ptr, ignore size
-		TAllocatorCounter<C>::mem_total -= n * sizeof(value_type);
+		TAllocatorCounter<C>::on_free(n * sizeof(value_type));
 		::operator delete((void *)p);
 	}
+
+	template <typename U>
+	bool operator==(const TAllocator<U, C>&) const { return true; }
+	template <typename U>
+	bool operator!=(const TAllocator<U, C>&) const { return false; }
+};
+
+
+/**
+ * TNodePool
+ *
+ * ̶Сڵأchunk룬нڵ㴮
+ * ÿ(ڵС, , )һأÿ߳һû
+ * ߳˳ʱнڵ㽻ȫchunkϵͳ
+ */
+template <size_t N, size_t A, typename C>
+struct TNodePool {
+	union _Node {
+		_Node*	next;
+		char	data[N];
+	};
+
+	enum {
+		node_size = (sizeof(_Node) + A - 1) / A * A,
+		chunk_nodes = (64 * 1024 / node_size) > 16 ? (64 * 1024 / node_size) : 16,
+	};
+
+	struct _FreeList {
+		_Node*	head;
+
+		_FreeList() : head(NULL) {}
+		~_FreeList() { // thread exit, hand free nodes to other threads
+			if (head == NULL)
+				return;
+			std::lock_guard<std::mutex> lock(orphan_lock());
+			_Node* tail = head;
+			while (tail->next)
+				tail = tail->next;
+			tail->next = orphan_head();
+			orphan_head() = head;
+		}
+	};
+
+	static void* allocate() {
+		_FreeList& list = free_list();
+		if (list.head == NULL)
+			_Refill(list);
+		_Node* node = list.head;
+		list.head = node->next;
+		return node;
+	}
+
+	static void deallocate(void* p) {
+		_FreeList& list = free_list();
+		_Node* node = (_Node*)p;
+		node->next = list.head;
+		list.head = node;
+	}
+
+protected:
+	static _FreeList& free_list() {
+		static thread_local _FreeList list;
+		return list;
+	}
+
+	static std::mutex& orphan_lock() {
+		static std::mutex lock;
+		return lock;
+	}
+
+	static _Node*& orphan_head() {
+		static _Node* head = NULL;
+		return head;
+	}
+
+	static void _Refill(_FreeList& list) {
+		{
+			std::lock_guard<std::mutex> lock(orphan_lock());
+			if (orphan_head()) {
+				list.head = orphan_head();
+				orphan_head() = NULL;
+				return;
+			}
+		}
+
+		char* chunk = (char*)::operator new(node_size * chunk_nodes);
+		for (size_t i = 0; i < chunk_nodes; ++ i) {
+			_Node* node = (_Node*)(chunk + i * node_size);
+			node->next = list.head;
+			list.head = node;
+		}
+	}
+};
+
+
+/**
+ * TPoolAllocator
+ *
+ * ڵallocatorTNodePooloperator new
+ * set/map/listһһڵ
+ * ڴͳͬTAllocator
+ */
+template <typename T, typename C>
+struct TPoolAllocator {
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
+	typedef T		value_type;
+	typedef T		*pointer, &reference;
+	typedef const T	*const_pointer, &const_reference;
+	typedef TNodePool<sizeof(T), alignof(T), C>	pool_type;
+
+	template <typename U>
+	struct rebind { typedef TPoolAllocator <U, C> other; };
+
+	TPoolAllocator() {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	TPoolAllocator(const TPoolAllocator <T, C> &) {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	template<class U>
+	TPoolAllocator(const TPoolAllocator<U, C>&) {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	~TPoolAllocator() {
+		TAllocatorCounter<C>::on_destroy();
+	}
+
+	pointer address(reference r) const { return &r; }
+	const_pointer address(const_reference r) const { return &r; }
+	size_type max_size() const { // estimate maximum array size
+		size_type _Count = (size_type)(-1) / sizeof (T);
+		return (0 < _Count ? _Count : 1);
+	}
+	void construct(pointer p, const T &t) { // construct object at _Ptr with value _Val
+		::new ((void *)p) T(t); 
+	}
+	void destroy(pointer p) { // destroy object at _Ptr
+		(void)(p);
+		p->~T();
+	}
+	pointer allocate(size_type n) { // one node from the pool, arrays from operator new
+		TAllocatorCounter<C>::check_budget(n * sizeof(value_type));
+		pointer p = (n == 1) ? (pointer)pool_type::allocate() : (pointer)::operator new(n * sizeof(value_type));
+		TAllocatorCounter<C>::on_alloc(n * sizeof(value_type));
+		return p;
+	}
+	pointer allocate(size_type n, const void *) { // allocate array of _Count elements, ignore hint
+		return (allocate(n));
+	}
+	void deallocate(pointer p, size_type n) { // back to the pool
+		TAllocatorCounter<C>::on_free(n * sizeof(value_type));
+		if (n == 1)
+			pool_type::deallocate(p);
+		else
+			::operator delete((void *)p);
+	}
+
+	template <typename U>
+	bool operator==(const TPoolAllocator<U, C>&) const { return true; }
+	template <typename U>
+	bool operator!=(const TPoolAllocator<U, C>&) const { return false; }
+};
+
+
+/**
+ * TArena
+ *
+ * bump pointerڴأֻ䲻գreleaseһͷȫchunk
+ * ҲŽarenaҲʱO(1)ͷţԪҪ
+ * ̰߳ȫ
+ */
+template <typename C>
+class TArena {
+public:
+	typedef size_t	size_type;
+
+	explicit TArena(size_type chunk_size = 64 * 1024)
+		: chunk_size(chunk_size), head(NULL), cur(NULL), end(NULL), live(0), live_count(0) {
+	}
+
+	~TArena() {
+		release();
+	}
+
+	void* allocate(size_type bytes, size_type align = alignof(std::max_align_t)) {
+		TAllocatorCounter<C>::check_budget(bytes); // may throw on budget
+		size_type pad = (align - (size_type)cur % align) % align;
+		if (cur == NULL || pad + bytes > (size_type)(end - cur)) {
+			_NewChunk(bytes + align);
+			pad = (align - (size_type)cur % align) % align;
+		}
+		TAllocatorCounter<C>::on_alloc(bytes);
+		char* p = cur + pad;
+		cur = p + bytes;
+		live += bytes;
+		++ live_count;
+		return p;
+	}
+
+	void deallocate(void*, size_type bytes) { // only counted, memory comes back on release
+		live -= bytes;
+		-- live_count;
+		TAllocatorCounter<C>::on_free(bytes);
+	}
+
+	void release() { // free all chunks, objects inside must not be used any more
+		while (head) {
+			_Chunk* next = head->next;
+			::operator delete((void*)head);
+			head = next;
+		}
+		cur = end = NULL;
+		if (live_count > 0)
+			TAllocatorCounter<C>::on_free(live, live_count);
+		live = 0;
+		live_count = 0;
+	}
+
+	size_type get_live_size() const {
+		return live;
+	}
+
+protected:
+	struct _Chunk {
+		_Chunk*	next;
+	};
+
+	void _NewChunk(size_type bytes) {
+		size_type size = sizeof(_Chunk) + (bytes > chunk_size ? bytes : chunk_size);
+		_Chunk* chunk = (_Chunk*)::operator new(size);
+		chunk->next = head;
+		head = chunk;
+		cur = (char*)(chunk + 1);
+		end = (char*)chunk + size;
+	}
+
+private:
+	TArena(const TArena&);
+	TArena& operator=(const TArena&);
+
+	size_type	chunk_size;
+	_Chunk*		head;
+	char*		cur;
+	char*		end;
+	size_type	live;
+	size_type	live_count;
+};
+
+
+/**
+ * TArenaAllocator
+ *
+ * TArenaallocatordeallocateڴ棬ֻͳ
+ */
+template <typename T, typename C>
+struct TArenaAllocator {
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
+	typedef T		value_type;
+	typedef T		*pointer, &reference;
+	typedef const T	*const_pointer, &const_reference;
+
+	template <typename U>
+	struct rebind { typedef TArenaAllocator <U, C> other; };
+
+	TArenaAllocator(TArena<C>& a) : arena(&a) {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	TArenaAllocator(const TArenaAllocator <T, C> & r) : arena(r.arena) {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	TArenaAllocator& operator=(const TArenaAllocator <T, C> & r) { // no new instance, nothing to count
+		arena = r.arena;
+		return *this;
+	}
+
+	template<class U>
+	TArenaAllocator(const TArenaAllocator<U, C>& r) : arena(r.arena) {
+		TAllocatorCounter<C>::on_construct();
+	}
+
+	~TArenaAllocator() {
+		TAllocatorCounter<C>::on_destroy();
+	}
+
+	pointer address(reference r) const { return &r; }
+	const_pointer address(const_reference r) const { return &r; }
+	size_type max_size() const { // estimate maximum array size
+		size_type _Count = (size_type)(-1) / sizeof (T);
+		return (0 < _Count ? _Count : 1);
+	}
+	void construct(pointer p, const T &t) { // construct object at _Ptr with value _Val
+		::new ((void *)p) T(t); 
+	}
+	void destroy(pointer p) { // destroy object at _Ptr
+		(void)(p);
+		p->~T();
+	}
+	pointer allocate(size_type n) { // bump from the arena
+		return (pointer)arena->allocate(n * sizeof(value_type), alignof(T));
+	}
+	pointer allocate(size_type n, const void *) { // allocate array of _Count elements, ignore hint
+		return (allocate(n));
+	}
+	void deallocate(pointer p, size_type n) { // counted only
+		arena->deallocate(p, n * sizeof(value_type));
+	}
+
+	template <typename U>
+	bool operator==(const TArenaAllocator<U, C>& r) const { return arena == r.arena; }
+	template <typename U>
+	bool operator!=(const TArenaAllocator<U, C>& r) const { return arena != r.arena; }
+
+	TArena<C>*	arena;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -108,6 +772,12 @@ struct TAllocator {
 #define MapAllocator(KT, T)				TAllocator<std::pair<const KT, T>, std::map<KT, T>>
 #define MapAllocatorCounter(KT, T)		TAllocatorCounter<std::map<KT, T>>
 
+#define SetPoolAllocator(T)				TPoolAllocator<T, std::set<T>>
+#define MapPoolAllocator(KT, T)			TPoolAllocator<std::pair<const KT, T>, std::map<KT, T>>
+
+#define SetArenaAllocator(T)			TArenaAllocator<T, std::set<T>>
+#define MapArenaAllocator(KT, T)		TArenaAllocator<std::pair<const KT, T>, std::map<KT, T>>
+
 class managed_string : public std::basic_string<char, std::char_traits<char>, StringAllocator>
 {
 public:
@@ -132,9 +802,19 @@ public:
 
 //////////////////////////////////////////////////////////////////////////
 template <typename C>
-typename TAllocatorCounter<C>::size_type TAllocatorCounter<C>::class_total = 0;
+typename TAllocatorCounter<C>::_Shard TAllocatorCounter<C>::shards[kAllocatorCounterShards];
+template <typename C>
+std::atomic<typename TAllocatorCounter<C>::size_type> TAllocatorCounter<C>::peak(0);
+template <typename C>
+std::atomic<typename TAllocatorCounter<C>::size_type> TAllocatorCounter<C>::sampled(0);
+template <typename C>
+std::atomic<typename TAllocatorCounter<C>::size_type> TAllocatorCounter<C>::soft_budget(0);
+template <typename C>
+std::atomic<typename TAllocatorCounter<C>::size_type> TAllocatorCounter<C>::hard_budget(0);
+template <typename C>
+std::atomic<bool> TAllocatorCounter<C>::budgeted(false);
 template <typename C>
-typename TAllocatorCounter<C>::size_type TAllocatorCounter<C>::mem_total = 0;
+std::atomic<bool> TAllocatorCounter<C>::pressure(false);
 
 
 #endif // __STLALLOCATOR_H__
\ No newline at end of file
@@ -14,8 +14,33 @@
 #ifndef __TINYMAP_H__
 #define __TINYMAP_H__
 
+#include <new>
+#include <memory>
 #include <vector>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
 #include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TINYMAP_AVX2
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define TINYMAP_SSE2
+#define TINYMAP_SSE42
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TINYMAP_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 /**
  * TinyMap
@@ -24,6 +49,11 @@
  * 滻Сmap߸Ƶʵ͵Ľṹݣ
  * ŵ㣺ڴС
  * ȱ㣺ɾ
+ * AΪvectorallocator
+ * N>0ʱǰNԪشڶڲtiny_small_vectorڴ
+ * insert(first, last)һκϲO(n log n)ȥصadopt_sortedֱӽӹ
+ * Pris_transparentʱfindɱȽͲңstring keyconst char*ʱpair
+ * try_emplace/operator[]/emplace(key, value)keyѴʱvalueʽemplaceȹpairٲ
  */
 
 template <typename K, typename T>
@@ -32,6 +62,7 @@ struct key_less
 	typedef K									key_type;
 	typedef T									mapped_type;
 	typedef std::pair <K, T>					value_type;
+	typedef void								is_transparent;	// find/try_emplace compare against the key directly
 
 	bool operator()(const value_type& _Left, const value_type& _Right) const
 	{
@@ -39,9 +70,276 @@ struct key_less
 		const key_type& _Rightkey = _Right.first;
 		return (_Leftkey < _Rightkey);
 	}
+
+	template <typename Kx>
+	bool operator()(const value_type& _Left, const Kx& _Rightkey) const
+	{
+		return (_Left.first < _Rightkey);
+	}
+
+	template <typename Kx>
+	bool operator()(const Kx& _Leftkey, const value_type& _Right) const
+	{
+		return (_Leftkey < _Right.first);
+	}
+};
+
+template <typename Pr, typename = void>
+struct tiny_is_transparent : std::false_type {};
+
+template <typename Pr>
+struct tiny_is_transparent <Pr, std::void_t<typename Pr::is_transparent> > : std::true_type {};
+
+/**
+ * tiny_small_vector
+ *
+ * ǰNԪطڶڲvectorֻʵTinyMapõĽӿ
+ * ͷΪָ+32λȣallocatorΪţ״̬ʱռռ䣨EBOstd::vector8ֽ
+ * UINT32_MAXlength_error
+ * ƶֵswappropagate_on_container_*allocatorTArenaAllocator״̬allocator
+ */
+template <typename T, size_t N, class A = std::allocator<T> >
+class tiny_small_vector : protected std::allocator_traits<A>::template rebind_alloc<T>
+{
+public:
+	typedef T										value_type;
+	typedef T*										iterator;
+	typedef const T*								const_iterator;
+	typedef size_t									size_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<T>	allocator_type;
+	typedef std::allocator_traits<allocator_type>	alloc_traits;
+
+	tiny_small_vector() : first(_Inline()), count(0), cap(N) {}
+
+	explicit tiny_small_vector(const allocator_type& _Alloc) : allocator_type(_Alloc), first(_Inline()), count(0), cap(N) {}
+
+	tiny_small_vector(const tiny_small_vector& right)
+		: allocator_type(alloc_traits::select_on_container_copy_construction(right._Alloc()))
+		, first(_Inline()), count(0), cap(N)
+	{
+		reserve(right.count);
+		for (size_type i = 0; i < right.count; ++ i)
+			::new ((void*)(first + i)) T(right.first[i]);
+		count = right.count;
+	}
+
+	tiny_small_vector(tiny_small_vector&& right) : allocator_type(std::move(right._Alloc())), first(_Inline()), count(0), cap(N)
+	{
+		_Steal(right);
+	}
+
+	~tiny_small_vector()
+	{
+		clear();
+		_FreeHeap();
+	}
+
+	tiny_small_vector& operator=(const tiny_small_vector& right)
+	{
+		if (this != &right)
+		{
+			clear();
+			if (alloc_traits::propagate_on_container_copy_assignment::value && _Alloc() != right._Alloc())
+			{	// the old buffer belongs to the old allocator
+				_FreeHeap();
+				_Alloc() = right._Alloc();
+			}
+			reserve(right.count);
+			for (size_type i = 0; i < right.count; ++ i, ++ count)
+				::new ((void*)(first + i)) T(right.first[i]);
+		}
+		return *this;
+	}
+
+	tiny_small_vector& operator=(tiny_small_vector&& right)
+	{
+		if (this != &right)
+		{
+			clear();
+			if (alloc_traits::propagate_on_container_move_assignment::value)
+			{
+				_FreeHeap();
+				_Alloc() = std::move(right._Alloc());
+				_Steal(right);
+			}
+			else if (_Alloc() == right._Alloc())
+			{
+				_FreeHeap();
+				_Steal(right);
+			}
+			else
+			{	// cannot take a buffer from another allocator, move element by element
+				reserve(right.count);
+				for (size_type i = 0; i < right.count; ++ i, ++ count)
+					::new ((void*)(first + i)) T(std::move(right.first[i]));
+				right.clear();
+			}
+		}
+		return *this;
+	}
+
+	allocator_type get_allocator() const { return _Alloc(); }
+	bool empty() const { return count == 0; }
+	size_type size() const { return count; }
+	size_type capacity() const { return cap; }
+	size_type max_size() const { return (size_type)UINT32_MAX; }
+	bool is_inline() const { return first == _Inline(); }
+	iterator begin() { return first; }
+	iterator end() { return first + count; }
+	const_iterator begin() const { return first; }
+	const_iterator end() const { return first + count; }
+	T& front() { return first[0]; }
+	T& back() { return first[count - 1]; }
+	T& operator[](size_type i) { return first[i]; }
+	const T& operator[](size_type i) const { return first[i]; }
+
+	void clear()
+	{
+		for (size_type i = 0; i < count; ++ i)
+			first[i].~T();
+		count = 0;
+	}
+
+	void reserve(size_type n)
+	{
+		if (n <= cap)
+			return;
+		if (n > max_size())
+			throw std::length_error("tiny_small_vector too long");
+		T* buf = alloc_traits::allocate(_Alloc(), n);
+		for (size_type i = 0; i < count; ++ i)
+		{
+			::new ((void*)(buf + i)) T(std::move(first[i]));
+			first[i].~T();
+		}
+		_FreeHeap();
+		first = buf;
+		cap = (uint32_t)n;
+	}
+
+	void push_back(const T& val)
+	{
+		insert(end(), val);
+	}
+
+	iterator insert(iterator _Where, const T& val)
+	{
+		T tmp(val); // val may live inside this vector
+		return _InsertTmp(_Where, tmp);
+	}
+
+	iterator insert(iterator _Where, T&& val)
+	{
+		T tmp(std::move(val));
+		return _InsertTmp(_Where, tmp);
+	}
+
+	template <class... Args>
+	iterator emplace(iterator _Where, Args&&... args)
+	{
+		T tmp(std::forward<Args>(args)...);
+		return _InsertTmp(_Where, tmp);
+	}
+
+	iterator erase(iterator _Where)
+	{
+		std::move(_Where + 1, end(), _Where);
+		first[-- count].~T();
+		return _Where;
+	}
+
+	void swap(tiny_small_vector& right)
+	{	// like std containers, swapping unequal allocators that do not propagate is undefined
+		if (this == &right)
+			return;
+		if (alloc_traits::propagate_on_container_swap::value)
+		{
+			using std::swap;
+			swap(_Alloc(), right._Alloc());
+		}
+		else
+			assert(_Alloc() == right._Alloc());
+
+		if (!is_inline() && !right.is_inline())
+		{
+			std::swap(first, right.first);
+			std::swap(count, right.count);
+			std::swap(cap, right.cap);
+			return;
+		}
+		tiny_small_vector tmp(right._Alloc());
+		tmp._Steal(*this);
+		_Steal(right);
+		right._Steal(tmp);
+	}
+
+protected:
+	T* _Inline() const
+	{
+		return (T*)buf;
+	}
+
+	allocator_type& _Alloc()
+	{
+		return *this;
+	}
+
+	const allocator_type& _Alloc() const
+	{
+		return *this;
+	}
+
+	iterator _InsertTmp(iterator _Where, T& tmp)
+	{
+		size_type pos = _Where - first;
+		if (count == cap)
+			reserve(cap ? std::min((size_type)cap * 2, max_size()) : 4);
+		if (pos == count)
+			::new ((void*)(first + count)) T(std::move(tmp));
+		else
+		{
+			::new ((void*)(first + count)) T(std::move(first[count - 1]));
+			std::move_backward(first + pos, first + count - 1, first + count);
+			first[pos] = std::move(tmp);
+		}
+		++ count;
+		return first + pos;
+	}
+
+	void _FreeHeap()
+	{
+		if (!is_inline())
+			alloc_traits::deallocate(_Alloc(), first, cap);
+		first = _Inline();
+		cap = N;
+	}
+
+	void _Steal(tiny_small_vector& right)
+	{	// *this is empty and inline; heap buffer moves as is, inline elements one by one
+		if (!right.is_inline())
+		{
+			first = right.first;
+			count = right.count;
+			cap = right.cap;
+			right.first = right._Inline();
+			right.count = 0;
+			right.cap = N;
+			return;
+		}
+		for (size_type i = 0; i < right.count; ++ i)
+			::new ((void*)(first + i)) T(std::move(right.first[i]));
+		count = right.count;
+		right.clear();
+	}
+
+protected:
+	T*				first;
+	uint32_t		count;
+	uint32_t		cap;
+	alignas(T) unsigned char	buf[N * sizeof(T)];
 };
 
-template < typename K, typename T, class Pr = key_less<K, T> >
+template < typename K, typename T, class Pr = key_less<K, T>, class A = std::allocator< std::pair<K, T> >, size_t N = 0 >
 class TinyMap
 {
 public:
@@ -50,11 +348,20 @@ public:
 	typedef std::pair <K, T>					value_type;
 	typedef T									reference;
 	typedef Pr									key_compare;
-	typedef std::vector <value_type>			container_type;
+	typedef A									allocator_type;
+	typedef typename std::conditional <N == 0,
+		std::vector <value_type, A>,
+		tiny_small_vector <value_type, N, A> >::type	container_type;
 	typedef typename container_type::size_type	size_type;
 	typedef typename container_type::iterator	iterator;
 
 	TinyMap() {}
+	explicit TinyMap(const allocator_type& _Alloc) : storage(_Alloc) {}
+	template <class InputIterator>
+	TinyMap(InputIterator _First, InputIterator _Last, bool cover_old = true)
+	{
+		insert(_First, _Last, cover_old);
+	}
 	~TinyMap() {}
 
 	bool empty() const
@@ -88,6 +395,136 @@ public:
 	}
 
 	iterator find(const key_type& _Keyval)
+	{
+		return _Find(_Keyval, tiny_is_transparent<Pr>());
+	}
+
+	template <typename Kx, typename Cmp = Pr, typename = typename std::enable_if<tiny_is_transparent<Cmp>::value>::type>
+	iterator find(const Kx& _Keyval)
+	{	// heterogeneous lookup, e.g. std::string key by const char*
+		return _Find(_Keyval, std::true_type());
+	}
+
+	iterator insert(const value_type& _Val, bool cover_old = true)
+	{
+		return _Insert(_Val, cover_old);
+	}
+
+	iterator insert(value_type&& _Val, bool cover_old = true)
+	{
+		return _Insert(std::move(_Val), cover_old);
+	}
+
+	template <class... Args>
+	std::pair <iterator, bool> try_emplace(const key_type& _Keyval, Args&&... args)
+	{	// constructs the value only if the key is absent
+		return _TryEmplace(_Keyval, std::forward<Args>(args)...);
+	}
+
+	template <class... Args>
+	std::pair <iterator, bool> try_emplace(key_type&& _Keyval, Args&&... args)
+	{
+		return _TryEmplace(std::move(_Keyval), std::forward<Args>(args)...);
+	}
+
+	template <typename Kx, typename V>
+	std::pair <iterator, bool> emplace(Kx&& _Keyval, V&& _Mapval)
+	{	// the common (key, value) form looks the key up first, the value is built only if it is absent
+		typedef typename std::conditional<std::is_same<typename std::decay<Kx>::type, key_type>::value, Kx&&, key_type>::type key_arg;
+		return _TryEmplace(static_cast<key_arg>(std::forward<Kx>(_Keyval)), std::forward<V>(_Mapval));
+	}
+
+	template <class... Args>
+	std::pair <iterator, bool> emplace(Args&&... args)
+	{	// never overwrites, like std::map::emplace
+		value_type _Val(std::forward<Args>(args)...);
+		return _TryEmplace(std::move(_Val.first), std::move(_Val.second));
+	}
+
+	template <class InputIterator>
+	void insert(InputIterator _First, InputIterator _Last, bool cover_old = true)
+	{	// sort the batch, drop its duplicates, then merge once
+		std::vector <value_type> batch(_First, _Last);
+		if (batch.empty())
+			return;
+		std::stable_sort(batch.begin(), batch.end(), comp);
+
+		// same key in the batch: later one wins if cover_old, else the first one
+		typename std::vector <value_type>::iterator _Dest = batch.begin();
+		for (typename std::vector <value_type>::iterator it = batch.begin() + 1; it != batch.end(); ++ it)
+		{
+			if (comp(*_Dest, *it))
+				*(++ _Dest) = *it;
+			else if (cover_old)
+				*_Dest = *it;
+		}
+		batch.erase(_Dest + 1, batch.end());
+
+		container_type merged(storage.get_allocator());
+		merged.reserve(storage.size() + batch.size());
+		iterator _Old = storage.begin();
+		typename std::vector <value_type>::iterator _New = batch.begin();
+		while (_Old != storage.end() && _New != batch.end())
+		{
+			if (comp(*_Old, *_New))
+				merged.push_back(*_Old ++);
+			else if (comp(*_New, *_Old))
+				merged.push_back(*_New ++);
+			else
+			{
+				merged.push_back(cover_old ? *_New : *_Old);
+				++ _Old;
+				++ _New;
+			}
+		}
+		for (; _Old != storage.end(); ++ _Old)
+			merged.push_back(*_Old);
+		for (; _New != batch.end(); ++ _New)
+			merged.push_back(*_New);
+		storage.swap(merged);
+	}
+
+	void adopt_sorted(container_type&& _Sorted)
+	{	// take a vector already sorted by key without duplicates, checked in debug only
+#ifndef NDEBUG
+		for (iterator it = _Sorted.begin(); it != _Sorted.end() && it + 1 != _Sorted.end(); ++ it)
+			assert(comp(*it, *(it + 1)));
+#endif
+		storage = std::move(_Sorted);
+	}
+
+	mapped_type& operator[](const key_type& _Keyval)
+	{
+		return ((*try_emplace(_Keyval).first).second);
+	}
+
+	mapped_type& operator[](key_type&& _Keyval)
+	{
+		return ((*try_emplace(std::move(_Keyval)).first).second);
+	}
+
+protected:
+	template <typename Kx>
+	iterator _LowerBound(const Kx& _Keyval, std::true_type)
+	{
+		return std::lower_bound(storage.begin(), storage.end(), _Keyval, comp);
+	}
+
+	iterator _LowerBound(const key_type& _Keyval, std::false_type)
+	{	// comparator only takes value_type
+		return std::lower_bound(storage.begin(), storage.end(), value_type(_Keyval, mapped_type()), comp);
+	}
+
+	template <typename Kx>
+	iterator _Find(const Kx& _Keyval, std::true_type)
+	{
+		iterator _Where = _LowerBound(_Keyval, std::true_type());
+		if (_Where == storage.end() || comp(_Keyval, *_Where))
+			return storage.end();
+		return _Where;
+	}
+
+	iterator _Find(const key_type& _Keyval, std::false_type)
 	{
 		value_type _Val(_Keyval, mapped_type());
 		iterator _Where = std::lower_bound(storage.begin(), storage.end(), _Val, comp);
@@ -96,26 +533,43 @@ public:
 		return _Where;
 	}
 
-	iterator insert(const value_type& _Val, bool cover_old = true)
+	template <typename V>
+	iterator _Insert(V&& _Val, bool cover_old)
 	{
 		if (storage.empty() || comp(storage.back(), _Val)) // back() < _Val
-			return storage.insert(storage.end(), _Val);
+			return storage.insert(storage.end(), std::forward<V>(_Val));
 		else if (!storage.empty() && comp(_Val, storage.front())) // _Val < front()
-			return storage.insert(storage.begin(), _Val);
+			return storage.insert(storage.begin(), std::forward<V>(_Val));
 
 		// lower_bound find >= _Val
 		iterator _Where = std::lower_bound(storage.begin(), storage.end(), _Val, comp);
 		if (_Where == storage.end() || comp(_Val, *_Where))
-			_Where = storage.insert(_Where, _Val);
+			_Where = storage.insert(_Where, std::forward<V>(_Val));
 		else if (cover_old)
-			*_Where = _Val;
+			*_Where = std::forward<V>(_Val);
 		return _Where;
 	}
 
-	mapped_type& operator[](const key_type& _Keyval)
+	template <typename Kx, class... Args>
+	std::pair <iterator, bool> _TryEmplace(Kx&& _Keyval, Args&&... args)
+	{
+		iterator _Where = _LowerBound(_Keyval, tiny_is_transparent<Pr>());
+		if (_Where != storage.end() && !_KeyLess(_Keyval, *_Where, tiny_is_transparent<Pr>()))
+			return std::pair <iterator, bool>(_Where, false);
+		_Where = storage.emplace(_Where, std::piecewise_construct,
+			std::forward_as_tuple(std::forward<Kx>(_Keyval)),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+		return std::pair <iterator, bool>(_Where, true);
+	}
+
+	bool _KeyLess(const key_type& _Keyval, const value_type& _Right, std::true_type)
 	{
-		iterator _Where = insert(value_type(_Keyval, mapped_type()), false);
-		return ((*_Where).second);
+		return comp(_Keyval, _Right);
+	}
+
+	bool _KeyLess(const key_type& _Keyval, const value_type& _Right, std::false_type)
+	{
+		return comp(value_type(_Keyval, mapped_type()), _Right);
 	}
 
 protected:
@@ -123,4 +577,540 @@ protected:
 	key_compare		comp;
 };
 
+template <typename K, typename T, size_t N>
+using InlineTinyMap = TinyMap <K, T, key_less<K, T>, std::allocator< std::pair<K, T> >, N>;
+
+
+const size_t kTinyMapLinearScanSize = 32;
+
+inline int tiny_popcount(unsigned int v)
+{
+#if defined(_MSC_VER)
+	return (int)__popcnt(v);
+#else
+	return __builtin_popcount(v);
+#endif
+}
+
+/**
+ * tiny_key_scan
+ *
+ * keyͳ < key ĸlower_boundλ
+ * 32/64λSSE2/AVX2һαȽ϶keyΪ޷֧ıѭ
+ */
+template <typename K>
+struct tiny_key_scan
+{
+	static size_t count_less(const K* keys, size_t n, const K& key)
+	{
+		size_t c = 0;
+		for (size_t i = 0; i < n; ++ i)
+			c += (keys[i] < key);
+		return c;
+	}
+};
+
+template <>
+struct tiny_key_scan<int32_t>
+{
+	static size_t count_less(const int32_t* keys, size_t n, int32_t key)
+	{
+		size_t c = 0, i = 0;
+#if defined(TINYMAP_AVX2)
+		__m256i k8 = _mm256_set1_epi32(key);
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+			c += tiny_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k8, v))));
+		}
+#endif
+#if defined(TINYMAP_AVX2) || defined(TINYMAP_SSE2)
+		__m128i k4 = _mm_set1_epi32(key);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+			c += tiny_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k4, v))));
+		}
+#endif
+		for (; i < n; ++ i)
+			c += (keys[i] < key);
+		return c;
+	}
+};
+
+template <>
+struct tiny_key_scan<uint32_t>
+{
+	static size_t count_less(const uint32_t* keys, size_t n, uint32_t key)
+	{
+		size_t c = 0, i = 0;
+		// flip the sign bit, unsigned order becomes signed order
+#if defined(TINYMAP_AVX2)
+		__m256i bias8 = _mm256_set1_epi32((int)0x80000000);
+		__m256i k8 = _mm256_xor_si256(_mm256_set1_epi32((int)key), bias8);
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), bias8);
+			c += tiny_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k8, v))));
+		}
+#endif
+#if defined(TINYMAP_AVX2) || defined(TINYMAP_SSE2)
+		__m128i bias = _mm_set1_epi32((int)0x80000000);
+		__m128i k4 = _mm_xor_si128(_mm_set1_epi32((int)key), bias);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), bias);
+			c += tiny_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k4, v))));
+		}
+#endif
+		for (; i < n; ++ i)
+			c += (keys[i] < key);
+		return c;
+	}
+};
+
+template <>
+struct tiny_key_scan<int64_t>
+{
+	static size_t count_less(const int64_t* keys, size_t n, int64_t key)
+	{
+		size_t c = 0, i = 0;
+#if defined(TINYMAP_AVX2)
+		__m256i k4 = _mm256_set1_epi64x(key);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+			c += tiny_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k4, v))));
+		}
+#elif defined(TINYMAP_SSE42)
+		__m128i k2 = _mm_set1_epi64x(key);
+		for (; i + 2 <= n; i += 2)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+			c += tiny_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k2, v))));
+		}
+#endif
+		for (; i < n; ++ i)
+			c += (keys[i] < key);
+		return c;
+	}
+};
+
+/**
+ * TinySoAMap
+ *
+ * TinyMapkey/valueֿŰ汾keyΪСmap
+ * ֻkey飬valuecache
+ * size <= kTinyMapLinearScanSize ʱSIMDͳƣʱ޷֧
+ */
+template <typename K, typename T, class A = std::allocator<T> >
+class TinySoAMap
+{
+public:
+	typedef K									key_type;
+	typedef T									mapped_type;
+	typedef std::pair <K, T>					value_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<K>	key_allocator_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<T>	mapped_allocator_type;
+	typedef std::vector <K, key_allocator_type>		key_container_type;
+	typedef std::vector <T, mapped_allocator_type>	mapped_container_type;
+	typedef typename key_container_type::size_type	size_type;
+
+	class iterator
+	{
+	public:
+		typedef std::pair <const K&, T&>		reference;
+
+		struct pointer
+		{
+			reference	ref;
+			reference* operator->() { return &ref; }
+		};
+
+		iterator(TinySoAMap* m = NULL, size_type i = 0) : owner(m), pos(i) {}
+
+		reference operator*() const { return reference(owner->keys[pos], owner->values[pos]); }
+		pointer operator->() const { pointer p = { **this }; return p; }
+		iterator& operator++() { ++ pos; return *this; }
+		iterator operator++(int) { iterator tmp = *this; ++ pos; return tmp; }
+		iterator& operator--() { -- pos; return *this; }
+		bool operator==(const iterator& right) const { return pos == right.pos; }
+		bool operator!=(const iterator& right) const { return pos != right.pos; }
+		size_type index() const { return pos; }
+
+	private:
+		TinySoAMap*	owner;
+		size_type	pos;
+	};
+
+	TinySoAMap() {}
+	explicit TinySoAMap(const A& _Alloc) : keys(key_allocator_type(_Alloc)), values(mapped_allocator_type(_Alloc)) {}
+	~TinySoAMap() {}
+
+	bool empty() const
+	{
+		return keys.empty();
+	}
+
+	size_type size() const
+	{
+		return keys.size();
+	}
+
+	void clear()
+	{
+		keys.clear();
+		values.clear();
+	}
+
+	iterator erase(iterator _Where)
+	{
+		size_type pos = _Where.index();
+		keys.erase(keys.begin() + pos);
+		values.erase(values.begin() + pos);
+		return iterator(this, pos);
+	}
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, keys.size());
+	}
+
+	iterator find(const key_type& _Keyval)
+	{
+		size_type pos = _LowerBound(_Keyval);
+		if (pos == keys.size() || _Keyval < keys[pos])
+			return end();
+		return iterator(this, pos);
+	}
+
+	iterator insert(const value_type& _Val, bool cover_old = true)
+	{
+		size_type pos = _LowerBound(_Val.first);
+		if (pos == keys.size() || _Val.first < keys[pos])
+		{
+			keys.insert(keys.begin() + pos, _Val.first);
+			values.insert(values.begin() + pos, _Val.second);
+		}
+		else if (cover_old)
+			values[pos] = _Val.second;
+		return iterator(this, pos);
+	}
+
+	template <class... Args>
+	std::pair <iterator, bool> try_emplace(const key_type& _Keyval, Args&&... args)
+	{
+		size_type pos = _LowerBound(_Keyval);
+		if (pos != keys.size() && !(_Keyval < keys[pos]))
+			return std::pair <iterator, bool>(iterator(this, pos), false);
+		keys.insert(keys.begin() + pos, _Keyval);
+		values.emplace(values.begin() + pos, std::forward<Args>(args)...);
+		return std::pair <iterator, bool>(iterator(this, pos), true);
+	}
+
+	mapped_type& operator[](const key_type& _Keyval)
+	{
+		return values[try_emplace(_Keyval).first.index()];
+	}
+
+protected:
+	size_type _LowerBound(const key_type& _Keyval) const
+	{
+		size_type n = keys.size();
+		if (n == 0)
+			return 0;
+		const key_type* data = &keys[0];
+		if (n <= kTinyMapLinearScanSize)
+			return tiny_key_scan<key_type>::count_less(data, n, _Keyval);
+
+		// branchless binary search, the compare compiles to cmov
+		const key_type* base = data;
+		while (n > 1)
+		{
+			size_type half = n / 2;
+			base = (base[half] < _Keyval) ? base + half : base;
+			n -= half;
+		}
+		return (base - data) + (*base < _Keyval);
+	}
+
+protected:
+	key_container_type		keys;
+	mapped_container_type	values;
+};
+
+const size_t kAdaptiveTinyMapPromoteSize = 128;
+const size_t kAdaptiveTinyMapChurnWindow = 64;	// ÿ64βɾһƶ
+const size_t kAdaptiveTinyMapChurnShift = 32;	// ƽÿƶ32ԪƵ
+const size_t kAdaptiveTinyMapMinBuckets = 16;
+
+/**
+ * AdaptiveTinyMap
+ *
+ * ģлֵTinyMapڱԤС
+ * СʱTinyMapһvectorֲңkey˳
+ * sizepromote_sizesizeСdemote_sizeҲɾƽÿƶkAdaptiveTinyMapChurnShiftԪʱ
+ * vector֮ϽѰַhash̽⣬uint32±꣩ҲO(1)ɾʱһԪؽ
+ * sizedemote_sizeºһβʱȥֵ֮䲻лض
+ * eraseı䲼֣it = erase(it)ıɾһֱЧhasheraseһԪػλ˳䣬Ҳkey˳
+ * hashֵFibonacci˷ȡλٶλͰstd::hashǺӳ䣬λͬkeyἷһ
+ * KҪ<򲼾֣Լ==Hhash֣
+ */
+template <typename K, typename T, class H = std::hash<K>, class A = std::allocator< std::pair<K, T> > >
+class AdaptiveTinyMap
+{
+public:
+	typedef K									key_type;
+	typedef T									mapped_type;
+	typedef std::pair <K, T>					value_type;
+	typedef H									hasher;
+	typedef A									allocator_type;
+	typedef std::vector <value_type, A>			container_type;
+	typedef typename std::allocator_traits<A>::template rebind_alloc<uint32_t>	index_allocator_type;
+	typedef std::vector <uint32_t, index_allocator_type>	index_type;
+	typedef typename container_type::size_type	size_type;
+	typedef typename container_type::iterator	iterator;
+
+	explicit AdaptiveTinyMap(size_type _Promote = kAdaptiveTinyMapPromoteSize, size_type _Demote = 0, const allocator_type& _Alloc = allocator_type())
+		: storage(_Alloc), index(index_allocator_type(_Alloc)), mask(0), shift(0)
+		, promote_size(_Promote), demote_size(_Demote ? _Demote : _Promote / 2), churn_ops(0), churn_moved(0)
+	{
+		assert(demote_size <= promote_size);
+	}
+
+	~AdaptiveTinyMap() {}
+
+	bool empty() const
+	{
+		return storage.empty();
+	}
+
+	size_type size() const
+	{
+		return storage.size();
+	}
+
+	bool is_hashed() const
+	{
+		return !index.empty();
+	}
+
+	void clear()
+	{
+		storage.clear();
+		index_type(index.get_allocator()).swap(index);
+		mask = 0;
+		churn_ops = 0;
+		churn_moved = 0;
+	}
+
+	iterator begin()
+	{
+		return storage.begin();
+	}
+
+	iterator end()
+	{
+		return storage.end();
+	}
+
+	iterator find(const key_type& _Keyval)
+	{
+		if (is_hashed())
+		{
+			for (size_t slot = _Home(_Keyval); index[slot]; slot = (slot + 1) & mask)
+			{
+				if (storage[index[slot] - 1].first == _Keyval)
+					return storage.begin() + (index[slot] - 1);
+			}
+			return storage.end();
+		}
+
+		iterator _Where = _LowerBound(_Keyval);
+		if (_Where == storage.end() || _Keyval < (*_Where).first)
+			return storage.end();
+		return _Where;
+	}
+
+	iterator insert(const value_type& _Val, bool cover_old = true)
+	{
+		std::pair <iterator, bool> ret = try_emplace(_Val.first, _Val.second);
+		if (!ret.second && cover_old)
+			(*ret.first).second = _Val.second;
+		return ret.first;
+	}
+
+	template <class... Args>
+	std::pair <iterator, bool> try_emplace(const key_type& _Keyval, Args&&... args)
+	{
+		if (is_hashed() && storage.size() < demote_size)
+			_Demote();
+
+		if (is_hashed())
+		{
+			size_t slot = _Home(_Keyval);
+			for (; index[slot]; slot = (slot + 1) & mask)
+			{
+				if (storage[index[slot] - 1].first == _Keyval)
+					return std::pair <iterator, bool>(storage.begin() + (index[slot] - 1), false);
+			}
+			storage.emplace_back(std::piecewise_construct, std::forward_as_tuple(_Keyval), std::forward_as_tuple(std::forward<Args>(args)...));
+			index[slot] = (uint32_t)storage.size();
+			if (storage.size() * 4 > (mask + 1) * 3) // load factor 0.75
+				_Rehash((mask + 1) * 2);
+			return std::pair <iterator, bool>(storage.end() - 1, true);
+		}
+
+		iterator _Where = _LowerBound(_Keyval);
+		if (_Where != storage.end() && !(_Keyval < (*_Where).first))
+			return std::pair <iterator, bool>(_Where, false);
+		size_type pos = _Where - storage.begin();
+		_Churn(storage.size() - pos);
+		storage.emplace(_Where, std::piecewise_construct, std::forward_as_tuple(_Keyval), std::forward_as_tuple(std::forward<Args>(args)...));
+		if (_ShouldPromote())
+			_Promote(); // index only, storage and iterators stay
+		return std::pair <iterator, bool>(storage.begin() + pos, true);
+	}
+
+	mapped_type& operator[](const key_type& _Keyval)
+	{
+		return ((*try_emplace(_Keyval).first).second);
+	}
+
+	iterator erase(iterator _Where)
+	{	// returns the element now at _Where's position
+		size_type pos = _Where - storage.begin();
+		if (!is_hashed())
+		{
+			_Churn(storage.size() - pos - 1);
+			_Where = storage.erase(_Where);
+			if (_ShouldPromote())
+				_Promote();
+			return _Where;
+		}
+
+		_EraseSlot(_IndexSlot(pos));
+		size_type last = storage.size() - 1;
+		if (pos != last)
+		{	// move the last element into the hole
+			index[_IndexSlot(last)] = (uint32_t)(pos + 1);
+			storage[pos] = std::move(storage[last]);
+		}
+		storage.pop_back();
+		return storage.begin() + pos;
+	}
+
+	size_type erase(const key_type& _Keyval)
+	{
+		iterator _Where = find(_Keyval);
+		if (_Where == storage.end())
+			return 0;
+		erase(_Where);
+		return 1;
+	}
+
+protected:
+	iterator _LowerBound(const key_type& _Keyval)
+	{
+		return std::lower_bound(storage.begin(), storage.end(), _Keyval, key_less<K, T>());
+	}
+
+	void _Churn(size_type _Moved)
+	{
+		++ churn_ops;
+		churn_moved += _Moved;
+	}
+
+	bool _ShouldPromote()
+	{	// past promote_size, or sorted inserts/erases keep shifting many elements
+		if (storage.size() > promote_size)
+			return true;
+		if (churn_ops < kAdaptiveTinyMapChurnWindow)
+			return false;
+		bool busy = churn_moved > churn_ops * kAdaptiveTinyMapChurnShift;
+		churn_ops = 0;
+		churn_moved = 0;
+		return busy && storage.size() >= demote_size;
+	}
+
+	void _Promote()
+	{
+		assert(storage.size() < (size_t)UINT32_MAX);
+		size_t buckets = kAdaptiveTinyMapMinBuckets;
+		while (buckets < storage.size() * 2)
+			buckets *= 2;
+		_Rehash(buckets);
+	}
+
+	void _Demote()
+	{	// back to the sorted layout
+		std::sort(storage.begin(), storage.end(), key_less<K, T>());
+		index_type(index.get_allocator()).swap(index);
+		mask = 0;
+		churn_ops = 0;
+		churn_moved = 0;
+	}
+
+	void _Rehash(size_t _Buckets)
+	{
+		index.assign(_Buckets, 0);
+		mask = _Buckets - 1;
+		shift = 64;
+		for (size_t n = _Buckets; n > 1; n >>= 1)
+			-- shift;
+		for (size_type i = 0; i < storage.size(); ++ i)
+		{
+			size_t slot = _Home(storage[i].first);
+			while (index[slot])
+				slot = (slot + 1) & mask;
+			index[slot] = (uint32_t)(i + 1);
+		}
+	}
+
+	size_t _Home(const key_type& _Keyval) const
+	{	// Fibonacci hashing, the high bits of the product mix every bit of the hash
+		return (size_t)(((uint64_t)hash(_Keyval) * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+
+	size_t _IndexSlot(size_type _Pos)
+	{	// the slot pointing at storage[_Pos]
+		size_t slot = _Home(storage[_Pos].first);
+		while (index[slot] != _Pos + 1)
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	void _EraseSlot(size_t _Slot)
+	{	// backward shift deletion, linear probing needs no tombstones
+		size_t hole = _Slot;
+		for (size_t slot = (hole + 1) & mask; index[slot]; slot = (slot + 1) & mask)
+		{
+			size_t home = _Home(storage[index[slot] - 1].first);
+			// move back unless home lies cyclically in (hole, slot]
+			bool stays = (hole <= slot) ? (hole < home && home <= slot) : (hole < home || home <= slot);
+			if (stays)
+				continue;
+			index[hole] = index[slot];
+			hole = slot;
+		}
+		index[hole] = 0;
+	}
+
+protected:
+	container_type	storage;
+	index_type		index;		// dense position + 1, 0 is empty
+	size_t			mask;
+	int				shift;		// 64 - log2(buckets)
+	size_type		promote_size;
+	size_type		demote_size;
+	size_type		churn_ops;
+	size_type		churn_moved;
+	hasher			hash;
+};
+
 #endif // __TINYMAP_H__
\ No newline at end of file
@@ -0,0 +1,599 @@
+/*
+@file		bench_main.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/20
+@brief		ܶԱ
+
+÷: bench_containers [size ...]
+ÿsizeÿkeyint64stringֱ
+	TinyMapCompressLazyMapMultiIndexMMapCompressStorage
+	std::mapstd::unordered_mapvector
+insertlookupscanupdateerase
+CompressLazyMapmget64multi_getÿ64keyops/seckeyƣӳٰ
+ops/sec1/16ĵӳٷλ(ns)ÿռֽ
+ֽTAllocatorCounterͳƣֻallocatorڴ
+CompressStorageڲkeymapallocator룩
+*/
+
+#include <map>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include <string_view>
+#include <unordered_map>
+#include "STLAllocator.h"
+#include "TinyMap.h"
+#include "CompressMap.h"
+#include "MultiIndexMMap.h"
+
+const size_t kBenchMinOps = 200000;		// ÿٵĲСsizeʱظ
+const size_t kBenchSampleEvery = 16;	// ÿ16βһӳ
+const size_t kBenchScanLength = 16;		// ÿηΧɨ
+const size_t kBenchBatchSize = 64;		// multi_getÿkey
+const double kBenchMaxSeconds = 0.5;	// ÿʱޣǰ
+
+struct BenchCounterTag {};
+
+template <typename T>
+using bench_allocator = TAllocator<T, BenchCounterTag>;
+typedef TAllocatorCounter<BenchCounterTag>		bench_counter;
+typedef std::basic_string<char, std::char_traits<char>, bench_allocator<char> >	bench_string;
+
+struct bench_payload
+{	// trivially copyable, CompressLazyMap copies values as bytes
+	int64_t		a;
+	int64_t		b;
+	int64_t		c;
+	int64_t		d;
+};
+
+static volatile int64_t bench_sink = 0;
+
+//////////////////////////////////////////////////////////////////////////
+// keys
+
+inline uint64_t bench_mix(uint64_t x)
+{	// splitmix64 finalizer, a bijection so distinct i gives distinct keys
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+template <typename K>
+struct bench_key;
+
+template <>
+struct bench_key<int64_t>
+{
+	static const char* name() { return "int64"; }
+	static int64_t make(uint64_t i) { return (int64_t)bench_mix(i); }
+};
+
+template <>
+struct bench_key<bench_string>
+{
+	static const char* name() { return "string"; }
+	static bench_string make(uint64_t i)
+	{	// 21 chars, longer than the small string buffer
+		char buf[32];
+		snprintf(buf, sizeof(buf), "user:%016llx", (unsigned long long)bench_mix(i));
+		return bench_string(buf);
+	}
+};
+
+struct bench_hash
+{
+	size_t operator() (int64_t k) const { return std::hash<int64_t>()(k); }
+	size_t operator() (const bench_string& k) const { return std::hash<std::string_view>()(std::string_view(k.data(), k.size())); }
+};
+
+inline bench_payload bench_make_payload(uint64_t i)
+{	// half repetitive, so blocks compress like real rows
+	bench_payload v = { (int64_t)i, (int64_t)(i & 0xFF), 0, (int64_t)bench_mix(i) };
+	return v;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// timing
+
+class bench_timer
+{
+public:
+	typedef std::chrono::steady_clock	clock;
+
+	bench_timer() : ops(0), elapsed_ns(0) {}
+
+	template <typename Op>
+	size_t run(size_t count, Op _Op)
+	{	// run _Op(0..count-1), stop early past the time budget, returns ops done
+		clock::time_point start = clock::now();
+		size_t i = 0;
+		for (; i < count; ++ i)
+		{
+			if (i % kBenchSampleEvery == 0)
+			{
+				clock::time_point t0 = clock::now();
+				_Op(i);
+				samples.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count());
+				if (over_budget(start))
+				{
+					++ i;
+					break;
+				}
+			}
+			else
+				_Op(i);
+		}
+		elapsed_ns += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+		ops += i;
+		return i;
+	}
+
+	template <typename Op>
+	void add(Op _Op)
+	{	// work outside the per op samples that still belongs to the workload, e.g. sort after inserts
+		clock::time_point start = clock::now();
+		_Op();
+		elapsed_ns += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+	}
+
+	bool exhausted() const
+	{
+		return elapsed_ns > kBenchMaxSeconds * 1e9;
+	}
+
+	void scale_ops(size_t n)
+	{	// each op was a batch of n
+		ops *= n;
+	}
+
+	double ops_per_sec() const
+	{
+		return elapsed_ns > 0 ? ops * 1e9 / elapsed_ns : 0;
+	}
+
+	double percentile(double p)
+	{
+		if (samples.empty())
+			return 0;
+		size_t k = (size_t)(p * (samples.size() - 1));
+		std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+		return samples[k];
+	}
+
+protected:
+	bool over_budget(clock::time_point start) const
+	{
+		double ns = elapsed_ns + (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+		return ns > kBenchMaxSeconds * 1e9;
+	}
+
+protected:
+	size_t					ops;
+	double					elapsed_ns;
+	std::vector <uint32_t>	samples;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// containers, one adapter each: insert/finish/lookup/scan/update/erase by (row number, key)
+
+template <typename K>
+struct bench_std_map
+{
+	typedef std::map <K, bench_payload, std::less<K>, bench_allocator<std::pair<const K, bench_payload> > >	map_type;
+	static const char* name() { return "std::map"; }
+	static const bool has_scan = true;
+
+	map_type	m;
+
+	void insert(size_t, const K& k, const bench_payload& v) { m[k] = v; }
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += m.find(k)->second.a; }
+	void scan(size_t, const K& k)
+	{
+		typename map_type::iterator it = m.lower_bound(k);
+		for (size_t n = 0; it != m.end() && n < kBenchScanLength; ++ it, ++ n)
+			bench_sink += it->second.a;
+	}
+	void update(size_t, const K& k, int64_t x) { m.find(k)->second.b = x; }
+	void erase(size_t, const K& k) { m.erase(k); }
+};
+
+template <typename K>
+struct bench_std_unordered_map
+{
+	typedef std::unordered_map <K, bench_payload, bench_hash, std::equal_to<K>, bench_allocator<std::pair<const K, bench_payload> > >	map_type;
+	static const char* name() { return "std::unordered_map"; }
+	static const bool has_scan = false;
+
+	map_type	m;
+
+	void insert(size_t, const K& k, const bench_payload& v) { m[k] = v; }
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += m.find(k)->second.a; }
+	void scan(size_t, const K&) {}
+	void update(size_t, const K& k, int64_t x) { m.find(k)->second.b = x; }
+	void erase(size_t, const K& k) { m.erase(k); }
+};
+
+template <typename K>
+struct bench_sorted_vector
+{
+	typedef std::pair <K, bench_payload>	value_type;
+	typedef std::vector <value_type, bench_allocator<value_type> >	vector_type;
+	typedef typename vector_type::iterator	iterator;
+	static const char* name() { return "sorted vector"; }
+	static const bool has_scan = true;
+
+	struct key_comp
+	{
+		bool operator() (const value_type& l, const K& r) const { return l.first < r; }
+	};
+
+	vector_type	m;
+
+	iterator lower_bound(const K& k) { return std::lower_bound(m.begin(), m.end(), k, key_comp()); }
+	void insert(size_t, const K& k, const bench_payload& v)
+	{
+		iterator it = lower_bound(k);
+		if (it != m.end() && it->first == k)
+			it->second = v;
+		else
+			m.insert(it, value_type(k, v));
+	}
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += lower_bound(k)->second.a; }
+	void scan(size_t, const K& k)
+	{
+		iterator it = lower_bound(k);
+		for (size_t n = 0; it != m.end() && n < kBenchScanLength; ++ it, ++ n)
+			bench_sink += it->second.a;
+	}
+	void update(size_t, const K& k, int64_t x) { lower_bound(k)->second.b = x; }
+	void erase(size_t, const K& k) { m.erase(lower_bound(k)); }
+};
+
+template <typename K>
+struct bench_tiny_map
+{
+	typedef TinyMap <K, bench_payload, key_less<K, bench_payload>, bench_allocator<std::pair<K, bench_payload> > >	map_type;
+	typedef typename map_type::iterator	iterator;
+	static const char* name() { return "TinyMap"; }
+	static const bool has_scan = true;
+
+	map_type	m;
+
+	void insert(size_t, const K& k, const bench_payload& v) { m.insert(std::pair<K, bench_payload>(k, v)); }
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += m.find(k)->second.a; }
+	void scan(size_t, const K& k)
+	{
+		iterator it = m.find(k);
+		for (size_t n = 0; it != m.end() && n < kBenchScanLength; ++ it, ++ n)
+			bench_sink += it->second.a;
+	}
+	void update(size_t, const K& k, int64_t x) { m.find(k)->second.b = x; }
+	void erase(size_t, const K& k) { m.erase(m.find(k)); }
+};
+
+template <typename K>
+struct bench_adaptive_tiny_map
+{
+	typedef AdaptiveTinyMap <K, bench_payload, bench_hash, bench_allocator<std::pair<K, bench_payload> > >	map_type;
+	static const char* name() { return "AdaptiveTinyMap"; }
+	static const bool has_scan = false;	// unordered once hashed
+
+	map_type	m;
+
+	void insert(size_t, const K& k, const bench_payload& v) { m.insert(std::pair<K, bench_payload>(k, v)); }
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += m.find(k)->second.a; }
+	void scan(size_t, const K&) {}
+	void update(size_t, const K& k, int64_t x) { m.find(k)->second.b = x; }
+	void erase(size_t, const K& k) { m.erase(k); }
+};
+
+template <typename K>
+struct bench_compress_lazy_map
+{
+	typedef CompressLazyMap <K, bench_payload, bench_allocator<bench_payload> >	map_type;
+	typedef typename map_type::iterator	iterator;
+	static const char* name() { return "CompressLazyMap"; }
+	static const bool has_scan = true;
+
+	map_type	m;
+
+	void insert(size_t, const K& k, const bench_payload& v) { m.set(k, v); }
+	void finish() { m.sort(); }
+	void lookup(size_t, const K& k) { bench_sink += m.get(m.find(k))->a; }
+	void scan(size_t, const K& k)
+	{
+		iterator it = m.find(k);
+		for (size_t n = 0; it != m.end() && n < kBenchScanLength; ++ it, ++ n)
+			bench_sink += m.get(it)->a;
+	}
+	void update(size_t i, const K& k, int64_t x)
+	{
+		bench_payload v = bench_make_payload(i);
+		v.b = x;
+		m.set(k, v);
+	}
+	void erase(size_t, const K& k) { m.del(k); }
+	void multi_lookup(const K* batch, size_t count)
+	{
+		struct sum_a
+		{
+			void operator() (size_t, bench_payload* v) const { bench_sink += v->a; }
+		};
+		m.multi_get(batch, count, sum_a());
+	}
+};
+
+template <typename K>
+struct bench_row
+{
+	K				key;
+	bench_payload	val;
+
+	bench_row(const K& k, const bench_payload& v) : key(k), val(v) {}
+};
+
+template <typename K>
+struct bench_multi_index_mmap
+{
+	typedef bench_row<K>	row_type;
+	typedef MultiIndexMMap <row_type, bench_allocator<row_type> >	map_type;
+	typedef typename map_type::iterator				iterator;
+	typedef typename map_type::index_iterator		index_iterator;
+	typedef typename map_type::index_value_iterator	index_value_iterator;
+	static const char* name() { return "MultiIndexMMap"; }
+	static const bool has_scan = true;
+
+	struct row_less : public i_multi_key_comp<row_type>
+	{
+		bool operator () (const row_type* lp, const row_type* rp) { return lp->key < rp->key; }
+	};
+
+	struct key_comp
+	{
+		bool operator () (const row_type* lp, const K& r) const { return lp->key < r; }
+		bool operator () (const K& l, const row_type* rp) const { return l < rp->key; }
+	};
+
+	map_type				m;
+	index_iterator			by_key;
+	std::vector <iterator>	rows;	// list iterators by row number, MultiIndexMMap::erase(pointer) is O(N)
+
+	bench_multi_index_mmap() { by_key = m.insert_index(new row_less); }
+
+	void insert(size_t i, const K& k, const bench_payload& v)
+	{
+		m.insert(row_type(k, v));
+		if (rows.size() <= i)
+			rows.resize(i + 1);
+		rows[i] = -- m.end();
+	}
+	void finish() {}
+	void lookup(size_t, const K& k) { bench_sink += m.find(k, by_key, key_comp())->val.a; }
+	void scan(size_t, const K& k)
+	{
+		index_value_iterator it = m.lower_bound(k, by_key, key_comp());
+		index_value_iterator it_end = m.end(by_key);
+		for (size_t n = 0; it != it_end && n < kBenchScanLength; ++ it, ++ n)
+			bench_sink += it.get_value()->val.a;
+	}
+	void update(size_t, const K& k, int64_t x)
+	{
+		struct set_b
+		{
+			int64_t	x;
+			void operator() (row_type& row) const { row.val.b = x; }
+		} mod = { x };
+		m.modify(m.find(k, by_key, key_comp()), mod);
+	}
+	void erase(size_t i, const K&) { m.erase(rows[i]); }
+};
+
+struct bench_compress_storage
+{	// raw blob store, keyed by the handle Insert returns
+	static const char* name() { return "CompressStorage"; }
+	static const bool has_scan = false;
+
+	TBufAllocator <bench_allocator<char> >	buf_alloc;
+	CompressStorage							m;
+	std::vector <int64_t>					handles;
+
+	bench_compress_storage() : m(0, &buf_alloc) {}
+
+	template <typename K>
+	void insert(size_t i, const K&, const bench_payload& v)
+	{
+		if (handles.size() <= i)
+			handles.resize(i + 1);
+		handles[i] = m.Insert((const char*)&v, sizeof(v));
+	}
+	void finish() { m.Compress(); }
+	template <typename K>
+	void lookup(size_t i, const K&) { bench_sink += ((bench_payload*)m.GetData(handles[i]))->a; }
+	template <typename K>
+	void scan(size_t, const K&) {}
+	template <typename K>
+	void update(size_t i, const K&, int64_t x)
+	{	// no in-place write, GetData is a transient inflated copy; replace the blob like a real update
+		bench_payload v = *(bench_payload*)m.GetData(handles[i]);
+		v.b = x;
+		m.Remove(handles[i]);
+		handles[i] = m.Insert((const char*)&v, sizeof(v));
+	}
+	template <typename K>
+	void erase(size_t i, const K&) { m.Remove(handles[i]); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// driver
+
+static void bench_report(const char* container, const char* key, size_t n, const char* workload, bench_timer& timer, double bytes_per_entry)
+{
+	printf("%-18s %-7s %8zu %-7s %14.0f %9.0f %9.0f %9.0f %10.1f\n",
+		container, key, n, workload, timer.ops_per_sec(),
+		timer.percentile(0.50), timer.percentile(0.99), timer.percentile(0.999), bytes_per_entry);
+	fflush(stdout);
+}
+
+template <typename Map, typename K>
+static void bench_multi_get(Map&, const std::vector<K>&, const std::vector<size_t>&, size_t, double)
+{	// only containers with a batched lookup
+}
+
+template <typename K>
+static void bench_multi_get(bench_compress_lazy_map<K>& m, const std::vector<K>& keys, const std::vector<size_t>& probes, size_t ops, double bytes_per_entry)
+{
+	size_t n = keys.size();
+	std::vector <K> batches;
+	batches.reserve(ops);
+	for (size_t j = 0; j < ops; ++ j)
+		batches.push_back(keys[probes[j % probes.size()]]);
+
+	bench_timer timer;
+	timer.run(ops / kBenchBatchSize, [&](size_t b) { m.multi_lookup(&batches[b * kBenchBatchSize], kBenchBatchSize); });
+	timer.scale_ops(kBenchBatchSize);
+	bench_report(bench_compress_lazy_map<K>::name(), bench_key<K>::name(), n, "mget64", timer, bytes_per_entry);
+}
+
+template <typename Map, typename K>
+static void bench_fill(Map& m, const std::vector<K>& keys)
+{
+	for (size_t i = 0; i < keys.size(); ++ i)
+		m.insert(i, keys[i], bench_make_payload(i));
+	m.finish();
+}
+
+template <typename Map, typename K>
+static void bench_container(const std::vector<K>& keys, const std::vector<size_t>& probes)
+{
+	const char* container = Map::name();
+	const char* key = bench_key<K>::name();
+	size_t n = keys.size();
+	size_t rounds = std::max <size_t>(1, kBenchMinOps / n);
+	double bytes_per_entry = 0;
+
+	{	// insert, fresh container per round
+		bench_timer timer;
+		for (size_t r = 0; r < rounds && !timer.exhausted(); ++ r)
+		{
+			Map* m = new Map;
+			timer.run(n, [&](size_t i) { m->insert(i, keys[i], bench_make_payload(i)); });
+			timer.add([&]() { m->finish(); });
+			delete m;
+		}
+
+		// memory of a complete container, the timed rounds may stop half way
+		size_t base = bench_counter::get_mem_size();
+		Map* m = new Map;
+		bench_fill(*m, keys);
+		bytes_per_entry = (double)(bench_counter::get_mem_size() - base) / n;
+		delete m;
+		bench_report(container, key, n, "insert", timer, bytes_per_entry);
+	}
+
+	{	// lookup, scan and update on one filled container
+		Map* m = new Map;
+		bench_fill(*m, keys);
+		size_t ops = std::max(n, kBenchMinOps);
+
+		bench_timer lookup;
+		lookup.run(ops, [&](size_t j) { size_t i = probes[j % probes.size()]; m->lookup(i, keys[i]); });
+		bench_report(container, key, n, "lookup", lookup, bytes_per_entry);
+
+		if (Map::has_scan)
+		{
+			bench_timer scan;
+			scan.run(ops / kBenchScanLength, [&](size_t j) { size_t i = probes[j % probes.size()]; m->scan(i, keys[i]); });
+			bench_report(container, key, n, "scan", scan, bytes_per_entry);
+		}
+
+		bench_multi_get(*m, keys, probes, ops, bytes_per_entry);
+
+		bench_timer update;
+		update.run(ops, [&](size_t j) { size_t i = probes[j % probes.size()]; m->update(i, keys[i], (int64_t)j); });
+		bench_report(container, key, n, "update", update, bytes_per_entry);
+		delete m;
+	}
+
+	{	// erase every key in random order, fresh container per round, filling is not timed
+		std::vector <size_t> order(n);
+		for (size_t i = 0; i < n; ++ i)
+			order[i] = i;
+		std::shuffle(order.begin(), order.end(), std::mt19937_64(n));
+
+		bench_timer timer;
+		for (size_t r = 0; r < rounds && !timer.exhausted(); ++ r)
+		{
+			Map* m = new Map;
+			bench_fill(*m, keys);
+			timer.run(n, [&](size_t j) { size_t i = order[j]; m->erase(i, keys[i]); });
+			delete m;
+		}
+		bench_report(container, key, n, "erase", timer, bytes_per_entry);
+	}
+}
+
+template <typename K>
+static void bench_key_type(size_t n)
+{
+	std::vector <K> keys;
+	keys.reserve(n);
+	for (size_t i = 0; i < n; ++ i)
+		keys.push_back(bench_key<K>::make(i));
+
+	std::vector <size_t> probes(std::max(n, kBenchMinOps));
+	std::mt19937_64 rng(n * 31 + 7);
+	for (size_t j = 0; j < probes.size(); ++ j)
+		probes[j] = (size_t)(rng() % n);
+
+	bench_container <bench_std_map<K> >(keys, probes);
+	bench_container <bench_std_unordered_map<K> >(keys, probes);
+	bench_container <bench_sorted_vector<K> >(keys, probes);
+	bench_container <bench_tiny_map<K> >(keys, probes);
+	bench_container <bench_adaptive_tiny_map<K> >(keys, probes);
+	bench_container <bench_compress_lazy_map<K> >(keys, probes);
+	bench_container <bench_multi_index_mmap<K> >(keys, probes);
+	if (std::is_same<K, int64_t>::value)
+		bench_container <bench_compress_storage>(keys, probes);	// ignores the key
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector <size_t> sizes;
+	for (int i = 1; i < argc; ++ i)
+	{
+		long long n = atoll(argv[i]);
+		if (n > 0)
+			sizes.push_back((size_t)n);
+	}
+	if (sizes.empty())
+	{
+		sizes.push_back(16);
+		sizes.push_back(256);
+		sizes.push_back(4096);
+		sizes.push_back(32768);
+	}
+
+	printf("%-18s %-7s %8s %-7s %14s %9s %9s %9s %10s\n",
+		"container", "key", "size", "op", "ops/sec", "p50(ns)", "p99(ns)", "p999(ns)", "bytes/ent");
+	for (size_t i = 0; i < sizes.size(); ++ i)
+	{
+		bench_key_type <int64_t>(sizes[i]);
+		bench_key_type <bench_string>(sizes[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+@file		test_allocator.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		TAllocatorCounterͳƺbudgetغarena allocatorinterned_string
+*/
+
+#include <set>
+#include <map>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_set>
+#include "test_util.h"
+#include "STLAllocator.h"
+#include "InternedString.h"
+#include "TinyMap.h"
+
+struct CountTag {};
+struct BudgetTag {};
+struct FailTag {};
+struct ArenaTag {};
+
+static void test_counter()
+{
+	typedef TAllocatorCounter<CountTag> counter;
+	{
+		std::set<int, std::less<int>, TAllocator<int, CountTag> > s;
+		for (int i = 0; i < 1000; ++ i)
+			s.insert(i);
+		allocator_stats stats = counter::get_stats();
+		TEST_CHECK(stats.mem_total > 0 && stats.alloc_count == 1000);
+		TEST_CHECK(stats.peak >= stats.mem_total);
+	}
+	TEST_CHECK(counter::get_mem_size() == 0);
+	TEST_CHECK(counter::get_stats().free_count == 1000);
+
+	bool registered = false;
+	std::vector<std::string> names = TAllocatorRegistry::instance().categories();
+	for (size_t i = 0; i < names.size(); ++ i)
+		registered |= names[i].find("CountTag") != std::string::npos;
+	TEST_CHECK(registered);
+	TEST_CHECK(TAllocatorRegistry::instance().dump_json().find("CountTag") != std::string::npos);
+}
+
+static int pressure_calls = 0;
+static void on_pressure(size_t, void*)
+{
+	++ pressure_calls;
+}
+
+static void test_budget()
+{
+	typedef TAllocatorCounter<BudgetTag> counter;
+	counter::set_budget(1 << 20, 4 << 20);
+	counter::add_pressure_callback(on_pressure, NULL);
+
+	std::vector<std::vector<char, TAllocator<char, BudgetTag> > > blocks;
+	bool threw = false;
+	try
+	{
+		for (int i = 0; i < 100000; ++ i)
+			blocks.push_back(std::vector<char, TAllocator<char, BudgetTag> >(1000));
+	}
+	catch (allocator_budget_exceeded&)
+	{
+		threw = true;
+	}
+	TEST_CHECK(threw);
+	TEST_CHECK(pressure_calls == 1);
+	TEST_CHECK(counter::get_mem_size() <= (size_t)(4 << 20));
+
+	// freeing below soft re-arms the callback, churn at a flat live size does not fire it
+	blocks.clear();
+	for (int i = 0; i < 20000; ++ i)
+		std::vector<char, TAllocator<char, BudgetTag> > churn(1000);
+	TEST_CHECK(pressure_calls == 1);
+	for (int i = 0; i < 2000; ++ i)
+		blocks.push_back(std::vector<char, TAllocator<char, BudgetTag> >(1000));
+	TEST_CHECK(pressure_calls == 2);
+	blocks.clear();
+	counter::set_budget(0, 0);
+}
+
+static void test_failed_allocation()
+{	// operator new throwing leaves the counters untouched
+#ifndef __SANITIZE_ADDRESS__	// asan aborts on a huge operator new instead of throwing
+	typedef TAllocatorCounter<FailTag> counter;
+	TAllocator<char, FailTag> alloc;
+	try
+	{
+		alloc.allocate((size_t)-1 / 2);
+	}
+	catch (std::bad_alloc&)
+	{
+	}
+	TEST_CHECK(counter::get_mem_size() == 0);
+	TEST_CHECK(counter::get_stats().alloc_count == 0);
+#endif
+}
+
+static void test_pool_and_arena()
+{
+	{
+		std::set<int, std::less<int>, SetPoolAllocator(int)> s;
+		for (int i = 0; i < 100000; ++ i)
+			s.insert(i * 7 % 100003);
+		for (int i = 0; i < 50000; ++ i)
+			s.erase(i);
+		std::thread t([]() {
+			std::map<int, double, std::less<int>, MapPoolAllocator(int, double)> m;
+			for (int i = 0; i < 1000; ++ i)
+				m[i] = i;
+		});
+		t.join();
+	}
+	TEST_CHECK(SetAllocatorCounter(int)::get_mem_size() == 0);
+
+	TArena<ArenaTag> arena;
+	{
+		typedef TArenaAllocator<std::pair<const int, double>, ArenaTag> alloc_type;
+		alloc_type alloc(arena);
+		std::map<int, double, std::less<int>, alloc_type> m(std::less<int>(), alloc);
+		for (int i = 0; i < 10000; ++ i)
+			m[i] = i;
+		TEST_CHECK(m[5000] == 5000);
+		TEST_CHECK(arena.get_live_size() > 0);
+	}
+	TEST_CHECK(TAllocatorCounter<ArenaTag>::get_mem_size() == 0);
+	arena.release();
+}
+
+static void test_interned_string()
+{
+	{
+		interned_string a("AAPL"), b(std::string("AAPL")), c("MSFT");
+		TEST_CHECK(a == b && a != c);
+		TEST_CHECK(strcmp(b.c_str(), "AAPL") == 0 && b.length() == 4);
+
+		TinyMap<interned_string, int> m;
+		m[a] = 1;
+		m[c] = 2;
+		TEST_CHECK(m.find(b) != m.end() && m.find(b)->second == 1);
+
+		std::unordered_set<interned_string> hs;
+		hs.insert(a);
+		hs.insert(b);
+		TEST_CHECK(hs.size() == 1);
+
+		// lexical order runs past embedded NULs, then shorter first
+		interned_string n1(std::string("a\0b", 3)), n2(std::string("a\0c", 3)), n3("a");
+		interned_string::lexical_less less;
+		TEST_CHECK(less(n1, n2) && !less(n2, n1));
+		TEST_CHECK(less(n3, n1) && !less(n1, n3) && !less(n1, n1));
+		std::set<interned_string, interned_string::lexical_less> ordered;
+		ordered.insert(n1);
+		ordered.insert(n2);
+		ordered.insert(n3);
+		TEST_CHECK(ordered.size() == 3 && *ordered.begin() == n3);
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++ t)
+		{
+			threads.push_back(std::thread([]() {
+				for (int i = 0; i < 20000; ++ i)
+				{
+					char buf[16];
+					snprintf(buf, sizeof(buf), "s%d", i % 300);
+					interned_string x(buf);
+					interned_string y = x;
+					if (!(y == interned_string(buf)))
+						abort();
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++ i)
+			threads[i].join();
+		TEST_CHECK(interned_string::pool_size() == 5);
+	}
+	TEST_CHECK(interned_string::pool_size() == 0);
+}
+
+int main()
+{
+	TEST_RUN(test_counter);
+	TEST_RUN(test_budget);
+	TEST_RUN(test_failed_allocation);
+	TEST_RUN(test_pool_and_arena);
+	TEST_RUN(test_interned_string);
+	return test_result();
+}
@@ -0,0 +1,253 @@
+/*
+@file		test_compress_map.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		CompressStorageպʹvalueCompressColdTierлCompressLazyMapmulti_get
+*/
+
+#include <map>
+#include <ctime>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include "test_util.h"
+#include "CompressMap.h"
+#include "InternedString.h"
+#include "MultiIndexMMap.h"
+
+struct Pod
+{
+	long a, b, c, d;
+};
+
+static bool read_back(CompressStorage& st, int64_t key, const std::string& want)
+{
+	std::string got(want.size(), 0);
+	return st.Read(key, 0, &got[0], (int64_t)got.size()) == (int64_t)got.size() && got == want;
+}
+
+static void test_storage_random()
+{	// random insert/remove/compress with values larger than a block mixed in
+	CompressStorage st(1024);
+	std::map<int64_t, std::string> ref;
+	std::mt19937 rng(3);
+	for (int op = 0; op < 20000; ++ op)
+	{
+		int c = (int)(rng() % 10);
+		if (c < 5 || ref.empty())
+		{
+			size_t len = (rng() % 20 == 0) ? 1024 + rng() % 5000 : 1 + rng() % 200;
+			std::string v(len, (char)('a' + rng() % 26));
+			for (size_t i = 0; i < len; i += 7)
+				v[i] = (char)('0' + rng() % 10);
+			ref[st.Insert(v.data(), (int64_t)len)] = v;
+		}
+		else if (c < 8)
+		{
+			std::map<int64_t, std::string>::iterator it = ref.begin();
+			std::advance(it, rng() % ref.size());
+			st.Remove(it->first);
+			ref.erase(it);
+		}
+		else if (c < 9)
+			st.Compress();
+		else
+		{
+			std::map<int64_t, std::string>::iterator it = ref.begin();
+			std::advance(it, rng() % ref.size());
+			TEST_CHECK(read_back(st, it->first, it->second));
+		}
+	}
+
+	for (std::map<int64_t, std::string>::iterator it = ref.begin(); it != ref.end(); ++ it)
+	{
+		TEST_CHECK(read_back(st, it->first, it->second));
+		if (it->second.size() <= 1024)
+			TEST_CHECK(memcmp(st.GetData(it->first), it->second.data(), it->second.size()) == 0);
+	}
+
+	// everything removed, only the open write block (rewound) is kept
+	for (std::map<int64_t, std::string>::iterator it = ref.begin(); it != ref.end(); ++ it)
+		st.Remove(it->first);
+	compress_map_stats stats;
+	st.QueryStats(stats);
+	TEST_CHECK(stats.block_count <= 1 && stats.stored_bytes == 0);
+}
+
+static void test_cold_tier_bounded()
+{	// demote/promote cycles must not grow the cold store
+	CompressColdTier tier(0, 4096);
+	std::vector<int64_t> handles;
+	for (int i = 0; i < 500; ++ i)
+	{
+		std::string v(300, 'x');
+		v += std::to_string(i);
+		handles.push_back(tier.Insert(v.data(), (int64_t)v.size()));
+	}
+
+	int64_t first_cold = 0;
+	int touched = 500;
+	for (int cycle = 0; cycle < 200; ++ cycle)
+	{
+		// only what was read since the last Demote is hot
+		TEST_CHECK(tier.Demote(time(NULL) + 10) == touched);
+		TEST_CHECK(tier.QueryHotBytes() == 0 && tier.Demote(time(NULL) + 10) == 0);
+		if (cycle == 0)
+			first_cold = tier.QueryColdBytes();
+		TEST_CHECK(tier.QueryColdBytes() <= first_cold * 2);
+		touched = 0;
+		for (int i = 0; i < 500; i += cycle % 3 + 1, ++ touched)
+		{
+			std::string out;
+			TEST_CHECK(tier.Get(handles[i], out) && out.substr(300) == std::to_string(i));
+		}
+	}
+
+	// recently read entries stay hot, idle ones go cold
+	CompressColdTier lru(100, 4096);
+	int64_t h1 = lru.Insert("one", 3), h2 = lru.Insert("two", 3);
+	TEST_CHECK(lru.Demote(time(NULL) + 10) == 0);
+	TEST_CHECK(lru.Demote(time(NULL) + 200) == 2 && lru.QueryHotBytes() == 0);
+	char buf[8] = { 0 };
+	TEST_CHECK(lru.Read(h2, 1, buf, sizeof(buf)) == 2 && memcmp(buf, "wo", 2) == 0);
+	TEST_CHECK(lru.QueryHotBytes() == 3 && lru.QueryLen(h1) == 3);
+
+	std::string out;
+	TEST_CHECK(tier.Set(handles[7], "new", 3) && tier.Get(handles[7], out) && out == "new");
+	tier.Remove(handles[7]);
+	TEST_CHECK(!tier.Get(handles[7], out) && tier.QueryLen(handles[7]) == -1);
+}
+
+struct Order
+{
+	int		id;
+	int64_t	note;	// CompressColdTier handle of the large text
+};
+
+struct ById : i_multi_key_comp<Order>
+{
+	bool operator()(const Order* l, const Order* r) { return l->id < r->id; }
+};
+
+static void test_cold_tier_rows()
+{	// rows keep the index field and a handle, the large field lives in the tier
+	CompressColdTier tier(60, 4096);
+	MultiIndexMMap<Order> m;
+	MultiIndexMMap<Order>::index_iterator by_id = m.insert_index(new ById);
+	for (int i = 0; i < 200; ++ i)
+	{
+		std::string note(5000 + i, (char)('a' + i % 26));
+		Order o = { i, tier.Insert(note.data(), (int64_t)note.size()) };
+		m.insert(o);
+	}
+	TEST_CHECK(tier.Demote(time(NULL) + 120) == 200);
+
+	for (int i = 0; i < 200; i += 7)
+	{
+		Order k = { i, 0 };
+		Order* row = m.find(k, by_id);
+		TEST_CHECK(row != NULL);
+		if (row == NULL)
+			continue;
+		std::vector<char> buf((size_t)tier.QueryLen(row->note));
+		TEST_CHECK(buf.size() == (size_t)(5000 + i));
+		TEST_CHECK(tier.Read(row->note, 0, buf.data(), (int64_t)buf.size()) == (int64_t)buf.size());
+		TEST_CHECK(buf.front() == 'a' + i % 26 && buf.back() == 'a' + i % 26);
+		int64_t seen = 0;
+		TEST_CHECK(tier.Visit(row->note, [&seen, &buf](const char* data, int64_t len) { seen = data[0] == buf[0] ? len : -1; }));
+		TEST_CHECK(seen == (int64_t)buf.size());
+	}
+}
+
+static void test_lazy_map()
+{
+	CompressLazyMap<int, Pod> m(1024);
+	for (int i = 0; i < 5000; ++ i)
+	{
+		Pod p = { i * 2, i & 7, 0, 0 };
+		m.set(i * 2, p);
+	}
+	m.sort();
+	TEST_CHECK(m.size() == 5000);
+	TEST_CHECK(m.get(m.find(1234))->a == 1234);
+	TEST_CHECK(m.find(1235) == m.end());
+
+	Pod p = { -1, 0, 0, 0 };
+	m.set(1234, p);
+	m.del(2);
+	m.sort();
+	TEST_CHECK(m.get(m.find(1234))->a == -1);
+	TEST_CHECK(m.find(2) == m.end());
+
+	// multi_get against single finds
+	std::mt19937 rng(5);
+	for (int round = 0; round < 20; ++ round)
+	{
+		int n = (int)(rng() % 300) + 1;
+		std::vector<int> keys(n);
+		for (int i = 0; i < n; ++ i)
+			keys[i] = (int)(rng() % 10005);
+		std::vector<Pod> out(n);
+		std::unique_ptr<bool[]> found(new bool[n]);
+		size_t got = m.multi_get(keys.data(), (size_t)n, out.data(), found.get());
+		size_t want = 0;
+		for (int i = 0; i < n; ++ i)
+		{
+			CompressLazyMap<int, Pod>::iterator it = m.find(keys[i]);
+			bool exists = it != m.end();
+			want += exists;
+			TEST_CHECK(found[i] == exists);
+			if (exists && found[i])
+				TEST_CHECK(out[i].a == m.get(it)->a);
+		}
+		TEST_CHECK(got == want);
+	}
+}
+
+static void test_lazy_map_string_keys()
+{
+	CompressLazyMap<std::string, Pod> m;
+	for (int i = 0; i < 100; ++ i)
+	{
+		Pod p = { i, 0, 0, 0 };
+		m.set(std::to_string(i), p);
+	}
+	m.emplace("x", Pod{ 42, 0, 0, 0 });
+	m.sort();
+	TEST_CHECK(m.get(m.find("x"))->a == 42);
+	TEST_CHECK(m.get(m.find(std::string("5")))->a == 5);
+	TEST_CHECK(m.get(m.find(std::string_view("77")))->a == 77);
+	TEST_CHECK(m.find(std::string_view("nope")) == m.end());
+
+	const char* keys[] = { "5", "77", "nope", "5" };
+	long sum = 0;
+	size_t got = m.multi_get(keys, 4, [&sum](size_t, Pod* v) { sum += v->a; });
+	TEST_CHECK(got == 3 && sum == 87);
+}
+
+static void test_lazy_map_interned_keys()
+{	// const char* converts to the key once and goes through find(const key_type&)
+	CompressLazyMap<interned_string, Pod> m;
+	m.set(interned_string("AAPL"), Pod{ 1, 0, 0, 0 });
+	m.set(interned_string("MSFT"), Pod{ 2, 0, 0, 0 });
+	m.sort();
+	TEST_CHECK(m.get(m.find("MSFT"))->a == 2);
+	TEST_CHECK(m.find("GOOG") == m.end());
+	m.del("AAPL");
+	TEST_CHECK(m.size() == 1 && m.find("AAPL") == m.end());
+}
+
+int main()
+{
+	TEST_RUN(test_storage_random);
+	TEST_RUN(test_cold_tier_bounded);
+	TEST_RUN(test_cold_tier_rows);
+	TEST_RUN(test_lazy_map);
+	TEST_RUN(test_lazy_map_string_keys);
+	TEST_RUN(test_lazy_map_interned_keys);
+	return test_result();
+}
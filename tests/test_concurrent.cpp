@@ -0,0 +1,106 @@
+/*
+@file		test_concurrent.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		ConcurrentMultiIndexMMapдǶread_guardreader slot
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "ConcurrentMultiIndexMMap.h"
+
+struct Row
+{
+	int a;
+	int pad[3];
+};
+
+struct ByA : i_multi_key_comp<Row>
+{
+	bool operator()(const Row* l, const Row* r) { return l->a < r->a; }
+};
+
+typedef ConcurrentMultiIndexMMap<Row>	row_map;
+
+static void test_nested_guards()
+{
+	row_map m;
+	row_map::index_iterator ia = m.insert_index(new ByA);
+	for (int i = 0; i < 100; ++ i)
+	{
+		Row r = { i, { 0 } };
+		m.insert(r);
+	}
+	row_map::read_guard g1(m);
+	row_map::read_guard g2(m);
+	row_map::read_guard g3(m);
+	Row k = { 5, { 0 } };
+	TEST_CHECK(m.find(g3, k, ia) != NULL);
+}
+
+static void test_readers_and_writer()
+{	// more readers than slots, each nesting a guard, while one writer modifies
+	row_map m;
+	row_map::index_iterator ia = m.insert_index(new ByA);
+	for (int i = 0; i < 1000; ++ i)
+	{
+		Row r = { i, { 0 } };
+		m.insert(r);
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < kConcurrentReaderSlots + 36; ++ t)
+	{
+		readers.push_back(std::thread([&m, ia, t, &stop, &bad]() {
+			while (!stop.load())
+			{
+				row_map::read_guard outer(m);
+				row_map::read_guard inner(m);
+				for (int i = 0; i < 20; ++ i)
+				{
+					Row k = { (t * 7 + i) % 2000, { 0 } };
+					Row* p = m.find(inner, k, ia);
+					if (p && p->a != k.a)
+						++ bad;
+				}
+				std::this_thread::yield();
+			}
+		}));
+	}
+
+	for (int i = 0; i < 3000; ++ i)
+	{
+		row_map::read_guard g(m);
+		Row k = { i % 1000, { 0 } };
+		Row* p = m.find(g, k, ia);
+		if (p)
+			m.modify(p, [](Row& r) { r.a += 1000; });
+	}
+	stop = true;
+	for (size_t i = 0; i < readers.size(); ++ i)
+		readers[i].join();
+	m.reclaim();
+
+	TEST_CHECK(bad.load() == 0);
+	TEST_CHECK(m.size() == 1000);
+	size_t visited = 0;
+	{
+		row_map::read_guard g(m);
+		Row lo = { 0, { 0 } }, hi = { 1000000, { 0 } };
+		visited = m.visit(g, lo, hi, ia, [](Row*) {});
+	}
+	TEST_CHECK(visited == 1000);
+}
+
+int main()
+{
+	TEST_RUN(test_nested_guards);
+	TEST_RUN(test_readers_and_writer);
+	return test_result();
+}
@@ -0,0 +1,281 @@
+/*
+@file		test_multi_index.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		MultiIndexMMapάmodifydeferredquery
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "test_util.h"
+#include "STLAllocator.h"
+#include "MultiIndexMMap.h"
+
+struct Row
+{
+	int a, b, c;
+};
+
+static std::atomic<long> compare_budget(-1); // >= 0: comparators throw once it runs out
+
+template <int F>
+struct ByField : i_multi_key_comp<Row>
+{
+	bool operator()(const Row* l, const Row* r)
+	{
+		if (compare_budget.load() >= 0 && -- compare_budget < 0)
+			throw std::runtime_error("compare");
+		return (&l->a)[F] < (&r->a)[F];
+	}
+};
+
+struct AKey
+{	// bare int key against index A
+	bool operator()(const Row* r, int k) const { return r->a < k; }
+	bool operator()(int k, const Row* r) const { return k < r->a; }
+};
+
+struct SetA
+{
+	int v;
+	void operator()(Row& r) const { r.a = v; }
+};
+
+typedef MultiIndexMMap<Row>				row_map;
+typedef row_map::index_iterator			row_index;
+
+template <int F, typename M>
+static bool index_sorted(M& m, typename M::index_iterator idx, size_t count)
+{
+	int prev = INT32_MIN;
+	size_t n = 0;
+	for (typename M::index_value_iterator it = m.begin(idx); it != m.end(idx); ++ it, ++ n)
+	{
+		int v = (&it->a)[F];
+		if (v < prev)
+			return false;
+		prev = v;
+	}
+	return n == count;
+}
+
+static void test_indexes()
+{
+	row_map m;
+	row_index ia = m.insert_index(new ByField<0>);
+	row_index ib = m.insert_index(new ByField<1>);
+	for (int i = 0; i < 100; ++ i)
+	{
+		Row r = { i, 100 - i, 0 };
+		m.insert(r);
+	}
+	Row k = { 50, 0, 0 };
+	Row* p = m.find(k, ia);
+	TEST_CHECK(p && p->a == 50);
+	TEST_CHECK(m.find(50, ia, AKey()) == p);
+	TEST_CHECK(m.find(500, ia, AKey()) == NULL);
+
+	TEST_CHECK(m.modify(p, SetA{ 1000 }));
+	TEST_CHECK(index_sorted<0>(m, ia, 100));
+	Row kb = { 0, 50, 0 };
+	TEST_CHECK(m.find(kb, ib) == p);
+
+	m.erase(p);
+	TEST_CHECK(m.size() == 99 && m.find(kb, ib) == NULL);
+	TEST_CHECK(index_sorted<1>(m, ib, 99));
+}
+
+static void test_query_temporaries()
+{	// index_range copies its keys, temporaries are fine
+	row_map m;
+	row_index ia = m.insert_index(new ByField<0>);
+	row_index ib = m.insert_index(new ByField<1>);
+	for (int i = 0; i < 100; ++ i)
+	{
+		Row r = { i, 100 - i, 0 };
+		m.insert(r);
+	}
+	row_map::index_range_vec ranges;
+	ranges.push_back(row_map::index_range(ia, Row{ 10, 0, 0 }, Row{ 20, 0, 0 }));
+	ranges.push_back(row_map::index_range(ib, Row{ 0, 85, 0 }, Row{ 0, 95, 0 }));
+	std::vector<Row*> out;
+	TEST_CHECK(m.query(ranges, out) == 6 && out.size() == 6);
+}
+
+static void test_bulk_and_deferred()
+{
+	row_map m;
+	row_index ia = m.insert_index(new ByField<0>);
+	row_index ib = m.insert_index(new ByField<1>);
+	row_index ic = m.insert_index(new ByField<2>);
+	std::vector<Row> rows;
+	for (int i = 0; i < 40000; ++ i)
+	{
+		Row r = { rand() % 1000, rand() % 1000, i };
+		rows.push_back(r);
+	}
+
+	// a comparator throwing inside the parallel build reaches the caller, not std::terminate
+	compare_budget = 200000;
+	bool threw = false;
+	try
+	{
+		m.insert(rows.begin(), rows.end());
+	}
+	catch (std::runtime_error&)
+	{
+		threw = true;
+	}
+	compare_budget = -1;
+	TEST_CHECK(threw && m.size() == 40000);
+	TEST_CHECK(index_sorted<0>(m, ia, 40000));
+	TEST_CHECK(index_sorted<1>(m, ib, 40000));
+	TEST_CHECK(index_sorted<2>(m, ic, 40000));
+
+	// deferred: erase while dirty leaves no stale nodes behind
+	m.set_deferred_index(true);
+	Row x = { 5, 5, -1 };
+	m.insert(x);
+	m.erase(m.begin());
+	m.set_deferred_index(false);
+	TEST_CHECK(index_sorted<2>(m, ic, m.size()));
+}
+
+struct RowArenaTag {};
+
+static void test_bulk_arena()
+{	// TArena is not thread-safe, the bulk build must stay on the caller's thread
+	typedef TArenaAllocator<Row, RowArenaTag>			alloc_type;
+	typedef MultiIndexMMap<Row, alloc_type>				arena_map;
+	TArena<RowArenaTag> arena;
+	{
+		arena_map m((alloc_type(arena)));
+		arena_map::index_iterator ia = m.insert_index(new ByField<0>);
+		arena_map::index_iterator ib = m.insert_index(new ByField<1>);
+		arena_map::index_iterator ic = m.insert_index(new ByField<2>);
+		std::vector<Row> rows;
+		for (int i = 0; i < (int)kMultiIndexParallelBuildSize * 2; ++ i)
+		{
+			Row r = { rand() % 1000, rand() % 1000, i };
+			rows.push_back(r);
+		}
+		m.insert(rows.begin(), rows.end());
+		TEST_CHECK(m.size() == rows.size());
+		TEST_CHECK(index_sorted<0>(m, ia, rows.size()));
+		TEST_CHECK(index_sorted<1>(m, ib, rows.size()));
+		TEST_CHECK(index_sorted<2>(m, ic, rows.size()));
+		TEST_CHECK(arena.get_live_size() > 0);
+	}
+	TEST_CHECK(!multi_index_parallel_allocator<alloc_type>::value);
+	TEST_CHECK(multi_index_parallel_allocator<std::allocator<Row> >::value);
+	arena.release();
+}
+
+static std::vector<char> read_file(const char* name)
+{
+	std::vector<char> data;
+	FILE* fp = fopen(name, "rb");
+	if (fp == NULL)
+		return data;
+	int c;
+	while ((c = fgetc(fp)) != EOF)
+		data.push_back((char)c);
+	fclose(fp);
+	return data;
+}
+
+static void write_file(const char* name, const std::vector<char>& data)
+{
+	FILE* fp = fopen(name, "wb");
+	if (fp == NULL)
+		return;
+	fwrite(data.data(), 1, data.size(), fp);
+	fclose(fp);
+}
+
+static void test_snapshot()
+{
+	const char* good_file = "test_multi_index_snap.bin";
+	const char* bad_file = "test_multi_index_bad.bin";
+	row_map m;
+	m.insert_index(new ByField<0>);
+	m.insert_index(new ByField<1>);
+	for (int i = 0; i < 1000; ++ i)
+	{
+		Row r = { rand() % 100, rand() % 100, i };
+		m.insert(r);
+	}
+	TEST_CHECK(m.save(good_file));
+	std::vector<char> good = read_file(good_file);
+
+	row_map n;
+	row_index ia = n.insert_index(new ByField<0>);
+	row_index ib = n.insert_index(new ByField<1>);
+	for (int i = 0; i < 7; ++ i)
+	{
+		Row r = { i, i, i };
+		n.insert(r);
+	}
+
+	// every broken file is rejected and leaves the live data alone
+	size_t order_off = sizeof(multi_index_snapshot_header) + 1000 * sizeof(Row);
+	std::vector<char> bad(good.begin(), good.end() - 10);
+	write_file(bad_file, bad);
+	TEST_CHECK(!n.load(bad_file) && n.size() == 7);
+
+	bad = good;
+	uint64_t huge = (uint64_t)1 << 40;
+	memcpy(&bad[offsetof(multi_index_snapshot_header, row_count)], &huge, sizeof(huge));
+	write_file(bad_file, bad);
+	TEST_CHECK(!n.load(bad_file) && n.size() == 7);
+
+	bad = good;
+	memcpy(&bad[order_off + 4], &bad[order_off], 4); // duplicate ordinal
+	write_file(bad_file, bad);
+	TEST_CHECK(!n.load(bad_file) && n.size() == 7);
+
+	bad = good;
+	std::swap_ranges(&bad[order_off], &bad[order_off] + 4, &bad[order_off + 4 * 999]); // out of order, only verify sees it
+	write_file(bad_file, bad);
+	TEST_CHECK(!n.load(bad_file, true) && n.size() == 7);
+
+	TEST_CHECK(n.load(good_file, true) && n.size() == 1000);
+
+	// the default load never calls a comparator
+	compare_budget = 0;
+	bool threw = false;
+	try
+	{
+		TEST_CHECK(n.load(good_file) && n.size() == 1000);
+	}
+	catch (std::runtime_error&)
+	{
+		threw = true;
+	}
+	compare_budget = -1;
+	TEST_CHECK(!threw);
+	TEST_CHECK(index_sorted<0>(n, ia, 1000));
+	TEST_CHECK(index_sorted<1>(n, ib, 1000));
+	Row r = { 1000, 1000, 0 };
+	n.insert(r);
+	TEST_CHECK(index_sorted<0>(n, ia, 1001));
+
+	remove(good_file);
+	remove(bad_file);
+}
+
+int main()
+{
+	TEST_RUN(test_indexes);
+	TEST_RUN(test_query_temporaries);
+	TEST_RUN(test_bulk_and_deferred);
+	TEST_RUN(test_bulk_arena);
+	TEST_RUN(test_snapshot);
+	return test_result();
+}
@@ -0,0 +1,289 @@
+/*
+@file		test_tinymap.cpp
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		TinyMapInlineTinyMapTinySoAMapAdaptiveTinyMaptiny_key_scanstd::map
+*/
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "test_util.h"
+#include "STLAllocator.h"
+#include "TinyMap.h"
+
+struct TinyArenaTag {};
+
+template <typename M>
+static bool same_as(M& m, const std::map<int, int>& ref)
+{	// same size and every key of ref found with its value
+	if (m.size() != ref.size())
+		return false;
+	for (std::map<int, int>::const_iterator it = ref.begin(); it != ref.end(); ++ it)
+	{
+		typename M::iterator found = m.find(it->first);
+		if (found == m.end() || (*found).second != it->second)
+			return false;
+	}
+	return true;
+}
+
+template <typename M>
+static bool sorted_as(M& m, const std::map<int, int>& ref)
+{
+	std::map<int, int>::const_iterator r = ref.begin();
+	for (typename M::iterator it = m.begin(); it != m.end(); ++ it, ++ r)
+	{
+		if (r == ref.end() || (*it).first != r->first)
+			return false;
+	}
+	return r == ref.end();
+}
+
+template <typename M>
+static void random_ops(M& m)
+{
+	std::map<int, int> ref;
+	std::mt19937 rng(7);
+	for (int op = 0; op < 5000; ++ op)
+	{
+		int k = (int)(rng() % 300);
+		if (rng() % 4)
+		{
+			m[k] = op;
+			ref[k] = op;
+		}
+		else if (m.find(k) != m.end())
+		{
+			m.erase(m.find(k));
+			ref.erase(k);
+		}
+	}
+	TEST_CHECK(same_as(m, ref));
+	TEST_CHECK(sorted_as(m, ref));
+}
+
+static void test_tinymap_basic()
+{
+	TinyMap<int, int> m;
+	random_ops(m);
+
+	TinyMap<int, int> c;
+	c.insert(std::make_pair(1, 1));
+	c.insert(std::make_pair(1, 2), false);
+	TEST_CHECK(c.find(1)->second == 1);
+	c.insert(std::make_pair(1, 3));
+	TEST_CHECK(c.find(1)->second == 3);
+
+	std::vector<std::pair<int, int> > in;
+	in.push_back(std::make_pair(3, 1));
+	in.push_back(std::make_pair(1, 1));
+	in.push_back(std::make_pair(3, 2));
+	TinyMap<int, int> bulk(in.begin(), in.end());
+	TEST_CHECK(bulk.size() == 2 && bulk.find(3)->second == 2);
+}
+
+static void test_tinymap_heterogeneous()
+{
+	TinyMap<std::string, int> m;
+	m["b"] = 2;
+	m[std::string("a")] = 1;
+	TEST_CHECK(m.try_emplace("c", 3).second);
+	std::pair<TinyMap<std::string, int>::iterator, bool> r = m.try_emplace("c", 4);
+	TEST_CHECK(!r.second && r.first->second == 3);
+	TEST_CHECK(m.find("a")->second == 1);
+	TEST_CHECK(m.find("zz") == m.end());
+
+	InlineTinyMap<std::string, std::unique_ptr<int>, 4> um;
+	for (int i = 0; i < 10; ++ i)
+		um.try_emplace(std::to_string(i), new int(i));
+	TEST_CHECK(um.size() == 10 && *um.find("7")->second == 7);
+}
+
+struct Counted
+{
+	static int constructed;
+	int v;
+
+	Counted(int x) : v(x) { ++ constructed; }
+};
+int Counted::constructed = 0;
+
+static void test_tinymap_emplace()
+{	// (key, value) emplace does not build the value for an existing key
+	TinyMap<int, Counted> m;
+	TEST_CHECK(m.emplace(1, 7).second && Counted::constructed == 1);
+	std::pair<TinyMap<int, Counted>::iterator, bool> r = m.emplace(1, 8);
+	TEST_CHECK(!r.second && r.first->second.v == 7 && Counted::constructed == 1);
+	TEST_CHECK(m.emplace(std::make_pair(2, Counted(9))).second);
+
+	TinyMap<std::string, int> sm;
+	TEST_CHECK(sm.emplace("a", 1).second && !sm.emplace("a", 2).second && sm.find("a")->second == 1);
+}
+
+static void test_inline_tinymap()
+{
+	InlineTinyMap<int, int, 8> m;
+	random_ops(m);
+
+	InlineTinyMap<int, int, 8> small;
+	for (int i = 0; i < 4; ++ i)
+		small[i] = i;
+	InlineTinyMap<int, int, 8> copy(small);
+	InlineTinyMap<int, int, 8> moved(std::move(m));
+	TEST_CHECK(copy.size() == 4 && copy.find(3)->second == 3);
+	TEST_CHECK(moved.size() > 8);
+}
+
+static void test_small_vector_allocators()
+{	// unequal arenas that do not propagate, elements must move instead of buffers
+	TArena<TinyArenaTag> a1, a2;
+	typedef TArenaAllocator<std::string, TinyArenaTag> alloc_type;
+	for (int n = 2; n <= 20; n += 18)
+	{
+		tiny_small_vector<std::string, 4, alloc_type> x((alloc_type(a1))), y((alloc_type(a2)));
+		for (int i = 0; i < n; ++ i)
+		{
+			x.push_back(std::string(30, (char)('a' + i)));
+			y.push_back(std::string(30, (char)('A' + i)));
+		}
+		x = std::move(y);
+		TEST_CHECK(x.get_allocator().arena == &a1);
+		TEST_CHECK(x.size() == (size_t)n && x[1][0] == 'B');
+
+		tiny_small_vector<std::string, 4, alloc_type> z((alloc_type(a1)));
+		for (int i = 0; i < n + 3; ++ i)
+			z.push_back("z");
+		x.swap(z);
+		TEST_CHECK(x.size() == (size_t)n + 3 && z[1][0] == 'B');
+		x = z;
+		TEST_CHECK(x.get_allocator().arena == &a1 && x.size() == (size_t)n);
+	}
+
+	tiny_small_vector<int, 2> v;
+	bool threw = false;
+	try
+	{
+		v.reserve((size_t)UINT32_MAX + 1);
+	}
+	catch (std::length_error&)
+	{
+		threw = true;
+	}
+	TEST_CHECK(threw);
+}
+
+static void test_soa_map()
+{
+	TinySoAMap<int, int> m;
+	random_ops(m);
+	m.try_emplace(100000, 9);
+	TEST_CHECK(m.find(100000)->second == 9);
+}
+
+static void test_adaptive_tinymap()
+{
+	std::mt19937 rng(11);
+	for (int round = 0; round < 6; ++ round)
+	{
+		AdaptiveTinyMap<int, int> m(round % 2 ? 32 : 128);
+		std::map<int, int> ref;
+		bool hashed = false;
+		int range = 100 + round * 200;
+		for (int op = 0; op < 20000; ++ op)
+		{
+			int k = (int)(rng() % range);
+			bool grow = (op / 4000) % 2 == 0;
+			if ((int)(rng() % 10) < (grow ? 7 : 3))
+			{
+				m[k] = op;
+				ref[k] = op;
+			}
+			else
+				TEST_CHECK(m.erase(k) == ref.erase(k));
+			hashed |= m.is_hashed();
+			if (!m.is_hashed() && op % 97 == 0)
+				TEST_CHECK(sorted_as(m, ref));
+		}
+		TEST_CHECK(same_as(m, ref));
+		if (round > 0)
+			TEST_CHECK(hashed);
+
+		// erase while iterating keeps visiting every element once
+		for (AdaptiveTinyMap<int, int>::iterator it = m.begin(); it != m.end(); )
+		{
+			if (it->first % 3 == 0)
+				it = m.erase(it);
+			else
+				++ it;
+		}
+		for (std::map<int, int>::iterator it = ref.begin(); it != ref.end(); )
+		{
+			if (it->first % 3 == 0)
+				ref.erase(it ++);
+			else
+				++ it;
+		}
+		TEST_CHECK(same_as(m, ref));
+
+		// shrinking below demote_size goes back to the sorted layout on the next insert
+		while (m.size() > 4)
+		{
+			ref.erase(m.begin()->first);
+			m.erase(m.begin());
+		}
+		m[-1] = -1;
+		ref[-1] = -1;
+		TEST_CHECK(!m.is_hashed() && sorted_as(m, ref));
+	}
+
+	// keys sharing their low bits must not pile into one probe cluster
+	AdaptiveTinyMap<long, int> strided;
+	for (int i = 0; i < 20000; ++ i)
+		strided[(long)i * 65536] = i;
+	for (int i = 0; i < 20000; ++ i)
+		TEST_CHECK(strided.find((long)i * 65536) != strided.end());
+}
+
+template <typename K>
+static void check_key_scan(std::mt19937& rng, K lo, K hi)
+{
+	for (int r = 0; r < 500; ++ r)
+	{
+		size_t n = rng() % 40;
+		std::vector<K> keys(n);
+		for (size_t i = 0; i < n; ++ i)
+			keys[i] = (rng() % 2) ? lo + (K)(rng() % 16) : hi - (K)(rng() % 16);
+		std::sort(keys.begin(), keys.end());
+		K key = (n && rng() % 3 == 0) ? keys[rng() % n] : ((rng() % 2) ? lo + (K)(rng() % 16) : hi - (K)(rng() % 16));
+		size_t want = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+		TEST_CHECK(tiny_key_scan<K>::count_less(keys.data(), n, key) == want);
+	}
+}
+
+static void test_key_scan()
+{
+	std::mt19937 rng(3);
+	check_key_scan<int32_t>(rng, INT32_MIN, INT32_MAX);
+	check_key_scan<uint32_t>(rng, 0, UINT32_MAX);
+	check_key_scan<uint32_t>(rng, 0x7FFFFFF0u, 0x80000010u);
+	check_key_scan<int64_t>(rng, INT64_MIN, INT64_MAX);
+}
+
+int main()
+{
+	TEST_RUN(test_tinymap_basic);
+	TEST_RUN(test_tinymap_heterogeneous);
+	TEST_RUN(test_tinymap_emplace);
+	TEST_RUN(test_inline_tinymap);
+	TEST_RUN(test_small_vector_allocators);
+	TEST_RUN(test_soa_map);
+	TEST_RUN(test_adaptive_tinymap);
+	TEST_RUN(test_key_scan);
+	return test_result();
+}
@@ -0,0 +1,43 @@
+/*
+@file		test_util.h
+@author		huangwei
+@param		Email: huang-wei@corp.netease.com
+@param		Copyright (c) 2004-2013  ׵繤
+@date		2013/6/24
+@brief		Ԫõļ꣬ReleaseͬЧassert
+*/
+
+#pragma once
+
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+#include <cstdio>
+
+inline int& test_failures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++ test_failures(); \
+		} \
+	} while (0)
+
+#define TEST_RUN(func) \
+	do { \
+		int before = test_failures(); \
+		func(); \
+		printf("%-40s %s\n", #func, test_failures() == before ? "ok" : "FAILED"); \
+	} while (0)
+
+inline int test_result()
+{
+	return test_failures() == 0 ? 0 : 1;
+}
+
+#endif // __TEST_UTIL_H__